@@ -0,0 +1,298 @@
+﻿#pragma once
+#include "DataBase.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Ограниченный кольцевой буфер без блокировок (несколько производителей,
+// один потребитель). Каждой записи присваивается порядковый номер (ticket)
+template<typename T>
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity) : enqueuePos(0), dequeuePos(0) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    // false - буфер заполнен
+    bool tryPush(T&& value, uint64_t& ticket) {
+        uint64_t pos = enqueuePos.load(memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            uint64_t seq = cell->sequence.load(memory_order_acquire);
+            int64_t diff = (int64_t)seq - (int64_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+        cell->value = move(value);
+        cell->sequence.store(pos + 1, memory_order_release);
+        ticket = pos;
+        return true;
+    }
+
+    // false - буфер пуст
+    bool tryPop(T& value, uint64_t& ticket) {
+        uint64_t pos = dequeuePos.load(memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            uint64_t seq = cell->sequence.load(memory_order_acquire);
+            int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = dequeuePos.load(memory_order_relaxed);
+            }
+        }
+        value = move(cell->value);
+        cell->sequence.store(pos + mask + 1, memory_order_release);
+        ticket = pos;
+        return true;
+    }
+
+    size_t size() const {
+        uint64_t enq = enqueuePos.load(memory_order_relaxed);
+        uint64_t deq = dequeuePos.load(memory_order_relaxed);
+        return enq > deq ? (size_t)(enq - deq) : 0;
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    struct Cell {
+        atomic<uint64_t> sequence;
+        T value;
+    };
+
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<uint64_t> enqueuePos;
+    alignas(64) atomic<uint64_t> dequeuePos;
+};
+
+// Режим надежности журнала аудита
+enum class AuditDurability {
+    Async,          // запрос не ждет записи в БД; при переполнении записи отбрасываются
+    WaitForFlush    // запрос ждет фиксации пакета, в который попала его запись
+};
+
+struct AuditPipelineConfig {
+    AuditDurability durability = AuditDurability::Async;
+    size_t capacity = 8192;                             // размер кольцевого буфера
+    size_t maxBatch = 512;                              // записей в одной транзакции
+    chrono::milliseconds flushInterval = chrono::milliseconds(5);
+};
+
+// Асинхронный журнал аудита: обработчики кладут записи в кольцевой буфер,
+// фоновый поток сбрасывает их в audit_logs пакетами
+class AuditPipeline {
+public:
+    struct Stats {
+        size_t queueDepth;
+        uint64_t enqueued;
+        uint64_t flushed;
+        uint64_t dropped;
+        uint64_t failed;
+        uint64_t batches;
+        uint64_t lastFlushMicros;
+        uint64_t maxFlushMicros;
+        uint64_t avgFlushMicros;
+    };
+
+    explicit AuditPipeline(DataBase& db, const AuditPipelineConfig& config = AuditPipelineConfig())
+        : db(db), config(config), ring(config.capacity), running(false), stopping(false),
+        flushRequested(false), enqueued(0), flushed(0), dropped(0), failed(0),
+        batches(0), lastFlushMicros(0), maxFlushMicros(0), totalFlushMicros(0) {}
+
+    ~AuditPipeline() { stop(); }
+
+    void start() {
+        if (running.exchange(true)) return;
+        stopping = false;
+        worker = thread(&AuditPipeline::run, this);
+    }
+
+    // Остановка; все записи, оставшиеся в буфере, сбрасываются
+    void stop() {
+        if (!running) return;
+        {
+            lock_guard<mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) worker.join();
+        running = false;
+    }
+
+    // Запись действия. false - запись отброшена (буфер переполнен) или не сохранена
+    bool log(int userId, const string& action, const string& objectType, int objectId) {
+        if (!running) {
+            // Конвейер не запущен - пишем напрямую
+            db.addAuditLog(userId, action, objectType, objectId);
+            return true;
+        }
+
+        AuditLog entry;
+        entry.user_id = userId;
+        entry.action = action;
+        entry.object_type = objectType;
+        entry.object_id = objectId;
+        entry.created_at = timestamp::nowMicros();     // время действия, а не записи пакета
+
+        uint64_t ticket = 0;
+        if (config.durability == AuditDurability::Async) {
+            if (!ring.tryPush({ move(entry), nullptr }, ticket)) {
+                dropped++;
+                return false;
+            }
+            enqueued++;
+            return true;
+        }
+
+        // WaitForFlush: результат именно этой записи приходит через promise;
+        // при переполнении ждем освобождения места
+        auto saved = make_shared<promise<bool>>();
+        future<bool> result = saved->get_future();
+        PendingEntry pending{ move(entry), move(saved) };
+        while (!ring.tryPush(move(pending), ticket)) {
+            requestFlush();
+            this_thread::yield();
+        }
+        enqueued++;
+        requestFlush();
+        return result.get();
+    }
+
+    AuditDurability durability() const { return config.durability; }
+
+    Stats stats() const {
+        uint64_t b = batches.load();
+        return {
+            ring.size(), enqueued.load(), flushed.load(), dropped.load(), failed.load(), b,
+            lastFlushMicros.load(), maxFlushMicros.load(), b ? totalFlushMicros.load() / b : 0
+        };
+    }
+
+private:
+    // Запись в буфере; saved - только в режиме WaitForFlush, получает
+    // true, когда запись зафиксирована, и false, если она не сохранена
+    struct PendingEntry {
+        AuditLog log;
+        shared_ptr<promise<bool>> saved;
+    };
+
+    DataBase& db;
+    AuditPipelineConfig config;
+    RingBuffer<PendingEntry> ring;
+    thread worker;
+    atomic<bool> running;
+
+    mutex wakeMutex;
+    condition_variable wake;
+    bool stopping;
+    bool flushRequested;
+
+    atomic<uint64_t> enqueued;
+    atomic<uint64_t> flushed;
+    atomic<uint64_t> dropped;
+    atomic<uint64_t> failed;
+    atomic<uint64_t> batches;
+    atomic<uint64_t> lastFlushMicros;
+    atomic<uint64_t> maxFlushMicros;
+    atomic<uint64_t> totalFlushMicros;
+
+    void requestFlush() {
+        {
+            lock_guard<mutex> lock(wakeMutex);
+            flushRequested = true;
+        }
+        wake.notify_one();
+    }
+
+    void run() {
+        vector<AuditLog> batch;
+        vector<shared_ptr<promise<bool>>> waiters;      // по одному на запись пакета
+        batch.reserve(config.maxBatch);
+        waiters.reserve(config.maxBatch);
+
+        while (true) {
+            PendingEntry entry;
+            uint64_t ticket = 0;
+            while (batch.size() < config.maxBatch && ring.tryPop(entry, ticket)) {
+                batch.push_back(move(entry.log));
+                waiters.push_back(move(entry.saved));
+            }
+
+            if (batch.empty()) {
+                unique_lock<mutex> lock(wakeMutex);
+                if (stopping) return;
+                wake.wait_for(lock, config.flushInterval,
+                    [this] { return stopping || flushRequested; });
+                flushRequested = false;
+                continue;
+            }
+
+            flush(batch, waiters);
+            batch.clear();
+            waiters.clear();
+        }
+    }
+
+    void flush(const vector<AuditLog>& batch, const vector<shared_ptr<promise<bool>>>& waiters) {
+        auto started = chrono::steady_clock::now();
+        bool ok = true;
+        vector<DataBase::AuditWriteError> errors;
+        try {
+            // Ошибка отдельной записи не мешает сохранить остальные
+            errors = db.addAuditLogBatch(batch);
+            flushed += batch.size() - errors.size();
+            failed += errors.size();
+            if (!errors.empty()) {
+                cerr << "Не сохранено записей журнала аудита: " << errors.size() << " из " << batch.size()
+                    << " (" << errors.front().error << ")" << endl;
+            }
+        }
+        catch (const exception& e) {
+            ok = false;
+            failed += batch.size();
+            cerr << "Ошибка записи журнала аудита: " << e.what() << endl;
+        }
+
+        uint64_t micros = (uint64_t)chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - started).count();
+        batches++;
+        lastFlushMicros = micros;
+        totalFlushMicros += micros;
+        uint64_t prevMax = maxFlushMicros.load();
+        while (micros > prevMax && !maxFlushMicros.compare_exchange_weak(prevMax, micros)) {}
+
+        vector<bool> stored(batch.size(), ok);
+        for (auto& error : errors) stored[error.index] = false;
+        for (size_t i = 0; i < waiters.size(); i++) {
+            if (waiters[i]) waiters[i]->set_value(stored[i]);
+        }
+    }
+};
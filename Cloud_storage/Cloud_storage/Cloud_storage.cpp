@@ -120,7 +120,8 @@ int main() {
             s.owner_id = j["owner_id"];
             s.secret_value = j["secret"];
             s.secret_type = j["secret_type"];
-            s.expires_at = j.value("expires_at", "");
+            // Срок в формате "YYYY-MM-DD HH:MM:SS" (UTC); пустой или неразборчивый - бессрочно
+            if (!timestamp::parse(j.value("expires_at", ""), s.expires_at)) s.expires_at = 0;
 
             int id = db.addSecret(s);
             sendSuccess(res, { {"secret_id", id} });
@@ -135,8 +136,8 @@ int main() {
                     {"id_secrets", s.id_secrets},
                     {"owner_id", s.owner_id},
                     {"type", s.secret_type},
-                    {"created_at", s.created_at},
-                    {"expires_at", s.expires_at}
+                    {"created_at", timestamp::format(s.created_at)},
+                    {"expires_at", timestamp::format(s.expires_at)}
                     });
             }
 
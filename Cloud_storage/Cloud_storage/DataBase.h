@@ -3,7 +3,22 @@
 #include <vector>
 #include <memory>
 #include <stdexcept>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <functional>
+#include <deque>
+#include <optional>
+#include <iterator>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
 #include "sqlite3.h"
+#include "Timestamp.h"
 #include <iostream>
 using namespace std;
 struct User {
@@ -12,87 +27,393 @@ struct User {
     string password_hash;
     string role;
     bool is_active;
-    string created_at;
+    int64_t created_at;         // микросекунды Unix
 
-    User() : id_user(0), is_active(true) {}
+    User() : id_user(0), is_active(true), created_at(0) {}
+};
+
+// Учетные данные пользователя: хеш пароля для проверки и все,
+// что нужно для определения прав
+struct AuthResult {
+    int id_user;
+    string username;
+    string password_hash;
+    string role;
+    bool is_active;
+
+    AuthResult() : id_user(0), is_active(false) {}
 };
 
 struct Secret {
     int id_secrets;
     int owner_id;
     string secret_value;
-    string created_at;
-    string expires_at;
+    int64_t created_at;         // микросекунды Unix
+    int64_t expires_at;         // 0 - бессрочный
     string secret_type;
 
-    Secret() : id_secrets(0), owner_id(0) {}
+    Secret() : id_secrets(0), owner_id(0), created_at(0), expires_at(0) {}
 };
 
 struct AuditLog {
     int id_audit_logs;
-    int user_id;
+    int user_id;                // 0 - автор неизвестен (в базе NULL)
     string action;
     string object_type;
     int object_id;
-    string created_at;
+    int64_t created_at;         // микросекунды Unix; 0 при записи - текущее время
 
-    AuditLog() : id_audit_logs(0), user_id(0), object_id(0) {}
+    AuditLog() : id_audit_logs(0), user_id(0), object_id(0), created_at(0) {}
 };
 
+// Фильтр журнала аудита; пустые поля не ограничивают выборку.
+// Интервал времени полуоткрытый: from <= created_at < to (микросекунды Unix)
+struct AuditFilter {
+    optional<int> userId;
+    optional<int64_t> from;
+    optional<int64_t> to;
+    string action;
+    string objectType;
+};
+
+
 
 
+// Позиция постраничной выборки: (created_at, id) последней выданной строки
+struct PageCursor {
+    int64_t created_at;
+    int id;
+
+    PageCursor() : created_at(0), id(0) {}
+    PageCursor(int64_t created_at, int id) : created_at(created_at), id(id) {}
+};
+
+// Страница результатов; next заполнен, только если hasMore
+template<typename T>
+struct Page {
+    vector<T> items;
+    bool hasMore = false;
+    PageCursor next;
+};
 
 class DatabaseException : public runtime_error {
 public:
     DatabaseException(const string& message) : runtime_error(message) {}
 };
 
-class DataBase {
-private:
-    sqlite3* db;
-    string dbPath;
-    DataBase() : db(nullptr) {}
+// Нет свободного соединения для чтения: перегрузка, запрос стоит повторить позже
+class DatabaseBusyException : public DatabaseException {
+public:
+    DatabaseBusyException(const string& message) : DatabaseException(message) {}
+};
 
+// Запрошенной строки нет (или у секрета истек срок действия)
+class NotFoundException : public DatabaseException {
 public:
-    // Singleton - получение единственного экземпляра
-    static DataBase& getInstance() {
-        static DataBase instance;
-        return instance;
-    }
+    NotFoundException(const string& message) : DatabaseException(message) {}
+};
 
-    ~DataBase() {
-        close();
-                }
+// Нарушен внешний ключ: ссылка на несуществующую строку
+class ForeignKeyException : public DatabaseException {
+public:
+    ForeignKeyException(const string& message) : DatabaseException(message) {}
+};
 
-    // Открытие базы данных
-    bool open(const string& path) {
-        dbPath = path;
-        int rc = sqlite3_open(path.c_str(), &db);
+// Нарушено ограничение уникальности
+class ConflictException : public DatabaseException {
+public:
+    ConflictException(const string& message) : DatabaseException(message) {}
+};
 
-        if (rc != SQLITE_OK) {
-            throw DatabaseException("Не удалось открыть базу данных: " +
-                string(sqlite3_errmsg(db)));
-        }
-        executeSQL("PRAGMA foreign_keys = ON;");
-        dropTables();
-        createTablesUsers();
-        createTablesSecrets();
-        cout << "База данных открыта: " << path << endl;
-        return true;
-    }
+// Идентификаторы запросов, которые выполняет DataBase
+enum class Query : int {
+    AddUser,
+    GetUserById,
+    GetUserByUsername,
+    GetAllUsers,
+    AddSecret,
+    GetSecretById,
+    GetSecretsByUser,
+    GetAllSecrets,
+    UpdateSecret,
+    SearchSecrets,
+    DeleteSecret,
+    AddAuditLog,
+    Authenticate,
+    UpdatePasswordHash,
+    Statistics,
+    ClearAllSecrets,
+    ClearAllUsers,
+    GetAuditLogs,
+    BeginImmediate,
+    Commit,
+    Savepoint,
+    ReleaseSavepoint,
+    RollbackToSavepoint,
+    ItemSavepoint,
+    ReleaseItemSavepoint,
+    RollbackToItemSavepoint,
+    SchemaVersion,
+    AddSchemaVersion,
+    SecretsPage,
+    SecretsPageAfter,
+    SecretsByUserPage,
+    SecretsByUserPageAfter,
+    UsersPage,
+    UsersPageAfter,
+    AuditLogsPage,
+    AuditLogsPageAfter,
+    AuditLogsFiltered,
+    AuditLogsByUserFiltered,
+    FullTextSearch,
+    FullTextSearchByOwner,
+    ExportSecrets,
+    ExportAuditLogs,
+    ExpiringSecrets,
+    DeleteExpiredSecret,
+    Count
+};
 
-    // Закрытие базы данных
-    void close() {
-        if (db) {
-            sqlite3_close(db);
-            db = nullptr;
-            cout << "База данных закрыта" << endl;
-        }
+// Текст SQL для каждого идентификатора запроса
+inline const char* querySql(Query id) {
+    static const char* const sql[] = {
+        // AddUser
+        "INSERT INTO users (username, password_hash, role, is_active, created_at) "
+        "VALUES (?, ?, ?, ?, ?);",
+        // GetUserById
+        "SELECT id_user, username, password_hash, role, is_active, created_at "
+        "FROM users WHERE id_user = ?;",
+        // GetUserByUsername
+        "SELECT id_user, username, password_hash, role, is_active, created_at "
+        "FROM users WHERE username = ?;",
+        // GetAllUsers
+        "SELECT id_user, username, password_hash, role, is_active, created_at "
+        "FROM users ORDER BY username;",
+        // AddSecret
+        "INSERT INTO secrets (owner_id, secret_value, expires_at, secret_type, created_at) "
+        "VALUES (?, ?, NULLIF(?, 0), ?, ?);",
+        // GetSecretById
+        "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
+        "FROM secrets WHERE id_secrets = ? "
+        "AND (expires_at IS NULL OR expires_at > now_micros());",
+        // GetSecretsByUser
+        "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
+        "FROM secrets WHERE owner_id = ? "
+        "AND (expires_at IS NULL OR expires_at > now_micros());",
+        // GetAllSecrets
+        "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
+        "FROM secrets WHERE (expires_at IS NULL OR expires_at > now_micros()) "
+        "ORDER BY created_at DESC;",
+        // UpdateSecret
+        "UPDATE secrets SET secret_value = ?, expires_at = NULLIF(?, 0), secret_type = ? "
+        "WHERE id_secrets = ? AND (expires_at IS NULL OR expires_at > now_micros()) "
+        "RETURNING owner_id;",
+        // SearchSecrets
+        "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
+        "FROM secrets WHERE (secret_value LIKE ? OR secret_type LIKE ?) "
+        "AND (? = 0 OR owner_id = ?) "
+        "AND (expires_at IS NULL OR expires_at > now_micros()) LIMIT ?;",
+        // DeleteSecret
+        "DELETE FROM secrets WHERE id_secrets = ? RETURNING owner_id;",
+        // AddAuditLog
+        "INSERT INTO audit_logs (user_id, action, object_type, object_id, created_at) "
+        "VALUES (?, ?, ?, ?, ?);",
+        // Authenticate
+        "SELECT id_user, username, password_hash, role, is_active FROM users "
+        "WHERE username = ?;",
+        // UpdatePasswordHash
+        "UPDATE users SET password_hash = ? WHERE id_user = ?;",
+        // Statistics
+        "SELECT s.total_actions, s.unique_users, COALESCE(lu.username, ''), COALESCE(fu.username, '') "
+        "FROM audit_stats s "
+        "LEFT JOIN users lu ON lu.id_user = s.last_user_id "
+        "LEFT JOIN users fu ON fu.id_user = s.first_user_id "
+        "WHERE s.id = 1;",
+        // ClearAllSecrets
+        "DELETE FROM secrets;",
+        // ClearAllUsers
+        "DELETE FROM users;",
+        // GetAuditLogs
+        "SELECT id_audit_logs, user_id, action, object_type, object_id, created_at "
+        "FROM audit_logs ORDER BY created_at DESC;",
+        // BeginImmediate
+        "BEGIN IMMEDIATE;",
+        // Commit
+        "COMMIT;",
+        // Savepoint
+        "SAVEPOINT write_op;",
+        // ReleaseSavepoint
+        "RELEASE write_op;",
+        // RollbackToSavepoint
+        "ROLLBACK TO write_op;",
+        // ItemSavepoint
+        "SAVEPOINT batch_item;",
+        // ReleaseItemSavepoint
+        "RELEASE batch_item;",
+        // RollbackToItemSavepoint
+        "ROLLBACK TO batch_item;",
+        // SchemaVersion
+        "SELECT COALESCE(MAX(version), 0) FROM schema_version;",
+        // AddSchemaVersion
+        "INSERT INTO schema_version (version, description) VALUES (?, ?);",
+        // SecretsPage
+        "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
+        "FROM secrets WHERE (expires_at IS NULL OR expires_at > now_micros()) "
+        "ORDER BY created_at DESC, id_secrets DESC LIMIT ?;",
+        // SecretsPageAfter
+        "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
+        "FROM secrets WHERE (created_at, id_secrets) < (?, ?) "
+        "AND (expires_at IS NULL OR expires_at > now_micros()) "
+        "ORDER BY created_at DESC, id_secrets DESC LIMIT ?;",
+        // SecretsByUserPage
+        "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
+        "FROM secrets WHERE owner_id = ? "
+        "AND (expires_at IS NULL OR expires_at > now_micros()) "
+        "ORDER BY created_at DESC, id_secrets DESC LIMIT ?;",
+        // SecretsByUserPageAfter
+        "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
+        "FROM secrets WHERE owner_id = ? AND (created_at, id_secrets) < (?, ?) "
+        "AND (expires_at IS NULL OR expires_at > now_micros()) "
+        "ORDER BY created_at DESC, id_secrets DESC LIMIT ?;",
+        // UsersPage
+        "SELECT id_user, username, password_hash, role, is_active, created_at "
+        "FROM users "
+        "ORDER BY created_at DESC, id_user DESC LIMIT ?;",
+        // UsersPageAfter
+        "SELECT id_user, username, password_hash, role, is_active, created_at "
+        "FROM users WHERE (created_at, id_user) < (?, ?) "
+        "ORDER BY created_at DESC, id_user DESC LIMIT ?;",
+        // AuditLogsPage
+        "SELECT id_audit_logs, user_id, action, object_type, object_id, created_at "
+        "FROM audit_logs "
+        "ORDER BY created_at DESC, id_audit_logs DESC LIMIT ?;",
+        // AuditLogsPageAfter
+        "SELECT id_audit_logs, user_id, action, object_type, object_id, created_at "
+        "FROM audit_logs WHERE (created_at, id_audit_logs) < (?, ?) "
+        "ORDER BY created_at DESC, id_audit_logs DESC LIMIT ?;",
+        // AuditLogsFiltered
+        // Пустой фильтр отключается условием (? = '' OR ...), поэтому индекс по
+        // action или object_type не используется: страница идет по idx_audit_created
+        // от верхней границы и проверяет фильтры в строках. Это принято для
+        // администраторской выборки: значений action и object_type единицы,
+        // подходящие строки встречаются часто, а лишний индекс замедлил бы
+        // каждую запись журнала
+        "SELECT id_audit_logs, user_id, action, object_type, object_id, created_at "
+        "FROM audit_logs WHERE created_at >= ? AND (created_at, id_audit_logs) < (?, ?) "
+        "AND (? = '' OR action = ?) AND (? = '' OR object_type = ?) "
+        "ORDER BY created_at DESC, id_audit_logs DESC LIMIT ?;",
+        // AuditLogsByUserFiltered
+        "SELECT id_audit_logs, user_id, action, object_type, object_id, created_at "
+        "FROM audit_logs WHERE user_id = ? AND created_at >= ? AND (created_at, id_audit_logs) < (?, ?) "
+        "AND (? = '' OR action = ?) AND (? = '' OR object_type = ?) "
+        "ORDER BY created_at DESC, id_audit_logs DESC LIMIT ?;",
+        // FullTextSearch
+        "SELECT s.id_secrets, s.owner_id, s.secret_value, s.created_at, s.expires_at, s.secret_type "
+        "FROM secrets_fts JOIN secrets s ON s.id_secrets = secrets_fts.rowid "
+        "WHERE secrets_fts MATCH ? AND (s.expires_at IS NULL OR s.expires_at > now_micros()) "
+        "ORDER BY secrets_fts.rank LIMIT ?;",
+        // FullTextSearchByOwner
+        "SELECT s.id_secrets, s.owner_id, s.secret_value, s.created_at, s.expires_at, s.secret_type "
+        "FROM secrets_fts JOIN secrets s ON s.id_secrets = secrets_fts.rowid "
+        "WHERE secrets_fts MATCH ? AND s.owner_id = ? AND (s.expires_at IS NULL OR s.expires_at > now_micros()) "
+        "ORDER BY secrets_fts.rank LIMIT ?;",
+        // ExportSecrets
+        "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
+        "FROM secrets WHERE id_secrets > ? "
+        "AND (expires_at IS NULL OR expires_at > now_micros()) ORDER BY id_secrets;",
+        // ExportAuditLogs
+        "SELECT id_audit_logs, user_id, action, object_type, object_id, created_at "
+        "FROM audit_logs WHERE id_audit_logs > ? ORDER BY id_audit_logs;",
+        // ExpiringSecrets
+        "SELECT id_secrets, expires_at FROM secrets "
+        "WHERE expires_at <= now_micros() + ? ORDER BY expires_at LIMIT ?;",
+        // DeleteExpiredSecret
+        "DELETE FROM secrets WHERE id_secrets = ? AND expires_at <= now_micros() RETURNING owner_id;",
+    };
+    static_assert(sizeof(sql) / sizeof(sql[0]) == (size_t)Query::Count,
+        "querySql: текст задан не для всех запросов");
+    return sql[(int)id];
+}
+
+// Запросы, которым разрешен полный просмотр таблицы или сортировка без индекса.
+// Остальные проверяются через EXPLAIN QUERY PLAN при открытии базы
+inline bool queryAllowsFullScan(Query id) {
+    switch (id) {
+    case Query::SearchSecrets:      // LIKE '%...%' для образцов короче триграммы
+    case Query::ClearAllSecrets:
+    case Query::ClearAllUsers:
+        return true;
+    default:
+        return false;
     }
+}
+
+// Шаг миграции схемы. Шаги применяются по возрастанию версии, каждый
+// в своей транзакции; номер примененной версии хранится в schema_version.
+// rebuildsTables - шаг пересоздает таблицы, на которые ссылаются внешние
+// ключи: он выполняется с отключенной проверкой ключей и проверяет их
+// целостность перед фиксацией
+struct Migration {
+    int version;
+    const char* description;
+    string sql;
+    bool rebuildsTables = false;
+};
 
-    // Создание таблиц
-    void createTablesUsers() {
-        string sql =
+inline const vector<Migration>& schemaMigrations() {
+    // Триггеры удаляются вместе со своей таблицей, поэтому при пересоздании
+    // таблиц они создаются заново тем же текстом
+    static const string ftsTriggers =
+            "CREATE TRIGGER IF NOT EXISTS secrets_fts_insert AFTER INSERT ON secrets BEGIN "
+            "INSERT INTO secrets_fts(rowid, secret_value, secret_type) "
+            "VALUES (new.id_secrets, new.secret_value, new.secret_type); END;"
+            "CREATE TRIGGER IF NOT EXISTS secrets_fts_delete AFTER DELETE ON secrets BEGIN "
+            "INSERT INTO secrets_fts(secrets_fts, rowid, secret_value, secret_type) "
+            "VALUES ('delete', old.id_secrets, old.secret_value, old.secret_type); END;"
+            "CREATE TRIGGER IF NOT EXISTS secrets_fts_update AFTER UPDATE OF secret_value, secret_type ON secrets BEGIN "
+            "INSERT INTO secrets_fts(secrets_fts, rowid, secret_value, secret_type) "
+            "VALUES ('delete', old.id_secrets, old.secret_value, old.secret_type); "
+            "INSERT INTO secrets_fts(rowid, secret_value, secret_type) "
+            "VALUES (new.id_secrets, new.secret_value, new.secret_type); END;";
+    static const string auditStatsTriggers =
+            "CREATE TRIGGER IF NOT EXISTS audit_stats_insert AFTER INSERT ON audit_logs BEGIN "
+            "UPDATE audit_stats SET "
+            "total_actions = total_actions + 1,"
+            "unique_users = unique_users + (new.user_id IS NOT NULL AND NOT EXISTS "
+            "(SELECT 1 FROM audit_user_activity WHERE user_id = new.user_id)),"
+            "first_user_id = CASE WHEN first_at IS NULL OR new.created_at < first_at "
+            "THEN new.user_id ELSE first_user_id END,"
+            "first_at = CASE WHEN first_at IS NULL OR new.created_at < first_at "
+            "THEN new.created_at ELSE first_at END,"
+            "last_user_id = CASE WHEN last_at IS NULL OR new.created_at >= last_at "
+            "THEN new.user_id ELSE last_user_id END,"
+            "last_at = CASE WHEN last_at IS NULL OR new.created_at >= last_at "
+            "THEN new.created_at ELSE last_at END "
+            "WHERE id = 1;"
+            // Действия без автора (user_id NULL) учитываются только в total_actions
+            "INSERT INTO audit_user_activity (user_id, actions) SELECT new.user_id, 1 "
+            "WHERE new.user_id IS NOT NULL "
+            "ON CONFLICT(user_id) DO UPDATE SET actions = actions + 1; END;"
+            // Журнал из кода не удаляется, но счетчики остаются верными и при ручной чистке
+            "CREATE TRIGGER IF NOT EXISTS audit_stats_delete AFTER DELETE ON audit_logs BEGIN "
+            "UPDATE audit_user_activity SET actions = actions - 1 WHERE user_id = old.user_id;"
+            "DELETE FROM audit_user_activity WHERE user_id = old.user_id AND actions <= 0;"
+            "UPDATE audit_stats SET "
+            "total_actions = total_actions - 1,"
+            "unique_users = unique_users - (old.user_id IS NOT NULL AND NOT EXISTS "
+            "(SELECT 1 FROM audit_user_activity WHERE user_id = old.user_id)),"
+            "first_user_id = (SELECT user_id FROM audit_logs ORDER BY created_at ASC LIMIT 1),"
+            "first_at = (SELECT MIN(created_at) FROM audit_logs),"
+            "last_user_id = (SELECT user_id FROM audit_logs ORDER BY created_at DESC LIMIT 1),"
+            "last_at = (SELECT MAX(created_at) FROM audit_logs) "
+            "WHERE id = 1; END;";
+    // Время - целое число микросекунд Unix; значение по умолчанию (с точностью
+    // до секунды) нужно только для вставок в обход приложения
+    static const string nowDefault = "DEFAULT (CAST(strftime('%s', 'now') AS INTEGER) * 1000000)";
+    static const string toMicros = " AS INTEGER) * 1000000";
+
+    static const vector<Migration> migrations = {
+        { 1, "Создание таблиц users, secrets, audit_logs",
             "CREATE TABLE IF NOT EXISTS users ("
             "id_user INTEGER PRIMARY KEY AUTOINCREMENT,"
             "username VARCHAR(100) NOT NULL UNIQUE,"
@@ -100,11 +421,7 @@ public:
             "role VARCHAR(100) NOT NULL,"
             "is_active BOOLEAN NOT NULL DEFAULT 1,"
             "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP"
-            ");";
-        executeSQL(sql);
-    }
-    void createTablesSecrets() {
-        string sql =
+            ");"
             "CREATE TABLE IF NOT EXISTS secrets ("
             "id_secrets INTEGER PRIMARY KEY AUTOINCREMENT,"
             "owner_id INTEGER NOT NULL,"
@@ -113,11 +430,7 @@ public:
             "expires_at TIMESTAMP,"
             "secret_type VARCHAR(50) NOT NULL,"
             "FOREIGN KEY(owner_id) REFERENCES users(id_user) ON DELETE CASCADE"
-            ");";
-        executeSQL(sql);
-    }
-    void createTablesAuditLogs() {
-        string sql =
+            ");"
             "CREATE TABLE IF NOT EXISTS audit_logs ("
             "id_audit_logs INTEGER PRIMARY KEY AUTOINCREMENT,"
             "user_id INTEGER NOT NULL,"
@@ -126,396 +439,1237 @@ public:
             "object_id INTEGER,"
             "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
             "FOREIGN KEY(user_id) REFERENCES users(id_user)"
-            ");";
-        executeSQL(sql);
-    }
-
-    // Добовление нового пользователя
-    int addUser(const User& user) {
-        if (userExists(user.username)) {
-            throw DatabaseException("Пользователь с таким именем уже существует");
+            ");" },
+        { 2, "Индексы по владельцу секрета, пользователю аудита и времени создания",
+            "CREATE INDEX IF NOT EXISTS idx_secrets_owner_created ON secrets(owner_id, created_at);"
+            "CREATE INDEX IF NOT EXISTS idx_secrets_created ON secrets(created_at);"
+            "CREATE INDEX IF NOT EXISTS idx_audit_user_created ON audit_logs(user_id, created_at);"
+            "CREATE INDEX IF NOT EXISTS idx_audit_created ON audit_logs(created_at);" },
+        { 3, "Индекс пользователей по времени создания для постраничной выборки",
+            "CREATE INDEX IF NOT EXISTS idx_users_created ON users(created_at);" },
+        { 4, "Полнотекстовый индекс секретов (FTS5, триграммы)",
+            "CREATE VIRTUAL TABLE IF NOT EXISTS secrets_fts USING fts5("
+            "secret_value, secret_type, content='secrets', content_rowid='id_secrets', tokenize='trigram');"
+            + ftsTriggers +
+            "INSERT INTO secrets_fts(secrets_fts) VALUES ('rebuild');" },
+        { 5, "Инкрементальная статистика журнала аудита",
+            // Одна строка со сводными счетчиками и число действий по каждому пользователю
+            "CREATE TABLE IF NOT EXISTS audit_stats ("
+            "id INTEGER PRIMARY KEY CHECK (id = 1),"
+            "total_actions INTEGER NOT NULL DEFAULT 0,"
+            "unique_users INTEGER NOT NULL DEFAULT 0,"
+            "first_user_id INTEGER,"
+            "first_at TIMESTAMP,"
+            "last_user_id INTEGER,"
+            "last_at TIMESTAMP"
+            ");"
+            "CREATE TABLE IF NOT EXISTS audit_user_activity ("
+            "user_id INTEGER PRIMARY KEY,"
+            "actions INTEGER NOT NULL"
+            ");"
+            // Заполнение по уже накопленному журналу
+            "INSERT OR REPLACE INTO audit_stats (id, total_actions, unique_users, "
+            "first_user_id, first_at, last_user_id, last_at) SELECT 1, "
+            "(SELECT COUNT(*) FROM audit_logs),"
+            "(SELECT COUNT(DISTINCT user_id) FROM audit_logs),"
+            "(SELECT user_id FROM audit_logs ORDER BY created_at ASC LIMIT 1),"
+            "(SELECT MIN(created_at) FROM audit_logs),"
+            "(SELECT user_id FROM audit_logs ORDER BY created_at DESC LIMIT 1),"
+            "(SELECT MAX(created_at) FROM audit_logs);"
+            "INSERT OR REPLACE INTO audit_user_activity (user_id, actions) "
+            "SELECT user_id, COUNT(*) FROM audit_logs GROUP BY user_id;"
+            + auditStatsTriggers },
+        { 6, "Покрывающий индекс журнала аудита для выборки по пользователю с фильтрами",
+            // id_audit_logs сразу после created_at сохраняет порядок страниц,
+            // остальные столбцы позволяют не обращаться к таблице
+            "DROP INDEX IF EXISTS idx_audit_user_created;"
+            "CREATE INDEX IF NOT EXISTS idx_audit_user_filter ON audit_logs("
+            "user_id, created_at, id_audit_logs, action, object_type, object_id);" },
+        { 7, "Частичный индекс секретов по сроку действия",
+            // Бессрочные секреты хранят NULL и в индекс не попадают
+            "UPDATE secrets SET expires_at = NULL WHERE expires_at = '';"
+            "CREATE INDEX IF NOT EXISTS idx_secrets_expires ON secrets(expires_at) "
+            "WHERE expires_at IS NOT NULL;" },
+        { 8, "Время создания и срок действия - целые микросекунды Unix вместо строк",
+            // Таблицы пересоздаются с целочисленными столбцами времени; id и счетчики
+            // AUTOINCREMENT сохраняются, индексы и триггеры создаются заново
+            "CREATE TABLE users_new ("
+            "id_user INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "username VARCHAR(100) NOT NULL UNIQUE,"
+            "password_hash VARCHAR(255) NOT NULL,"
+            "role VARCHAR(100) NOT NULL,"
+            "is_active BOOLEAN NOT NULL DEFAULT 1,"
+            "created_at INTEGER NOT NULL " + nowDefault +
+            ");"
+            "INSERT INTO sqlite_sequence (name, seq) SELECT 'users_new', seq FROM sqlite_sequence WHERE name = 'users';"
+            "INSERT INTO users_new (id_user, username, password_hash, role, is_active, created_at) "
+            "SELECT id_user, username, password_hash, role, is_active, "
+            "COALESCE(CAST(strftime('%s', created_at)" + toMicros + ", 0) FROM users;"
+            "DROP TABLE users;"
+            "ALTER TABLE users_new RENAME TO users;"
+            "CREATE INDEX idx_users_created ON users(created_at);"
+
+            "CREATE TABLE secrets_new ("
+            "id_secrets INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "owner_id INTEGER NOT NULL,"
+            "secret_value TEXT NOT NULL,"
+            "created_at INTEGER NOT NULL " + nowDefault + ","
+            "expires_at INTEGER,"
+            "secret_type VARCHAR(50) NOT NULL,"
+            "FOREIGN KEY(owner_id) REFERENCES users(id_user) ON DELETE CASCADE"
+            ");"
+            "INSERT INTO sqlite_sequence (name, seq) SELECT 'secrets_new', seq FROM sqlite_sequence WHERE name = 'secrets';"
+            // expires_at до миграции 7 писался в местном времени сервера, после нее - в UTC.
+            // Граница - время применения миграции 7: секреты, созданные раньше, переводятся
+            // из местного времени модификатором 'utc' (по правилам часового пояса машины,
+            // выполняющей миграцию). Срок, измененный после миграции 7 у секрета, созданного
+            // до нее, уже был в UTC и сдвинется на смещение пояса - такие строки не различить
+            "INSERT INTO secrets_new (id_secrets, owner_id, secret_value, created_at, expires_at, secret_type) "
+            "SELECT id_secrets, owner_id, secret_value, "
+            "COALESCE(CAST(strftime('%s', created_at)" + toMicros + ", 0), "
+            "CASE WHEN created_at IS NULL OR created_at < "
+            "(SELECT applied_at FROM schema_version WHERE version = 7) "
+            "THEN CAST(strftime('%s', expires_at, 'utc')" + toMicros + " "
+            "ELSE CAST(strftime('%s', expires_at)" + toMicros + " END, "
+            "secret_type FROM secrets;"
+            "DROP TABLE secrets;"
+            "ALTER TABLE secrets_new RENAME TO secrets;"
+            "CREATE INDEX idx_secrets_owner_created ON secrets(owner_id, created_at);"
+            "CREATE INDEX idx_secrets_created ON secrets(created_at);"
+            "CREATE INDEX idx_secrets_expires ON secrets(expires_at) WHERE expires_at IS NOT NULL;"
+            + ftsTriggers +
+
+            // Прежние версии писали user_id = 0 для действий без автора; такие строки
+            // не прошли бы проверку внешних ключей в конце шага, поэтому 0 становится NULL
+            "CREATE TABLE audit_logs_new ("
+            "id_audit_logs INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "user_id INTEGER,"
+            "action VARCHAR(100) NOT NULL,"
+            "object_type VARCHAR(50) NOT NULL,"
+            "object_id INTEGER,"
+            "created_at INTEGER NOT NULL " + nowDefault + ","
+            "FOREIGN KEY(user_id) REFERENCES users(id_user)"
+            ");"
+            "INSERT INTO sqlite_sequence (name, seq) SELECT 'audit_logs_new', seq FROM sqlite_sequence WHERE name = 'audit_logs';"
+            "INSERT INTO audit_logs_new (id_audit_logs, user_id, action, object_type, object_id, created_at) "
+            "SELECT id_audit_logs, NULLIF(user_id, 0), action, object_type, object_id, "
+            "COALESCE(CAST(strftime('%s', created_at)" + toMicros + ", 0) FROM audit_logs;"
+            "DROP TABLE audit_logs;"
+            "ALTER TABLE audit_logs_new RENAME TO audit_logs;"
+            "CREATE INDEX idx_audit_created ON audit_logs(created_at);"
+            "CREATE INDEX idx_audit_user_filter ON audit_logs("
+            "user_id, created_at, id_audit_logs, action, object_type, object_id);"
+            "UPDATE audit_stats SET "
+            "first_at = CAST(strftime('%s', first_at)" + toMicros + ","
+            "last_at = CAST(strftime('%s', last_at)" + toMicros + ";"
+            + auditStatsTriggers,
+            true },
+        { 9, "Журнал аудита: действие без известного автора хранит NULL в user_id",
+            // Для баз, где шаг 8 успел создать audit_logs с NOT NULL: снимается
+            // только пересозданием таблицы; внешний ключ на users остается
+            // и проверяется для всех непустых user_id
+            "CREATE TABLE audit_logs_new ("
+            "id_audit_logs INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "user_id INTEGER,"
+            "action VARCHAR(100) NOT NULL,"
+            "object_type VARCHAR(50) NOT NULL,"
+            "object_id INTEGER,"
+            "created_at INTEGER NOT NULL " + nowDefault + ","
+            "FOREIGN KEY(user_id) REFERENCES users(id_user)"
+            ");"
+            "INSERT INTO sqlite_sequence (name, seq) SELECT 'audit_logs_new', seq FROM sqlite_sequence WHERE name = 'audit_logs';"
+            "INSERT INTO audit_logs_new (id_audit_logs, user_id, action, object_type, object_id, created_at) "
+            "SELECT id_audit_logs, NULLIF(user_id, 0), action, object_type, object_id, created_at FROM audit_logs;"
+            "DROP TABLE audit_logs;"
+            "ALTER TABLE audit_logs_new RENAME TO audit_logs;"
+            "CREATE INDEX idx_audit_created ON audit_logs(created_at);"
+            "CREATE INDEX idx_audit_user_filter ON audit_logs("
+            "user_id, created_at, id_audit_logs, action, object_type, object_id);"
+            // Записи с user_id = 0 могли попасть в журнал при отключенных внешних ключах
+            "DELETE FROM audit_user_activity WHERE user_id = 0;"
+            "UPDATE audit_stats SET "
+            "unique_users = (SELECT COUNT(*) FROM audit_user_activity),"
+            "first_user_id = NULLIF(first_user_id, 0),"
+            "last_user_id = NULLIF(last_user_id, 0);"
+            + auditStatsTriggers,
+            true },
+    };
+    return migrations;
+}
+
+// Кэш подготовленных запросов одного соединения: каждый запрос компилируется
+// один раз, при повторном использовании выполняются только reset и привязка параметров.
+// Соединение в каждый момент принадлежит одному потоку, поэтому кэш не синхронизирован
+class StatementCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    // Захваченный запрос; при уничтожении сбрасывается и возвращается в кэш
+    class Statement {
+    public:
+        explicit Statement(sqlite3_stmt* stmt) : stmt(stmt) {}
+        Statement(Statement&& other) noexcept : stmt(other.stmt) {
+            other.stmt = nullptr;
         }
-        string sql =
-            "INSERT INTO users (username, password_hash, role, is_active) "
-            "VALUES (?, ?, ?, ?);";
+        Statement(const Statement&) = delete;
+        Statement& operator=(const Statement&) = delete;
 
-        sqlite3_stmt* stmt;
-        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+        ~Statement() {
+            if (stmt) {
+                sqlite3_reset(stmt);
+                sqlite3_clear_bindings(stmt);
+            }
+        }
 
-        sqlite3_bind_text(stmt, 1, user.username.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 2, user.password_hash.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 3, user.role.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_int(stmt, 4, user.is_active);
+        operator sqlite3_stmt* () const { return stmt; }
 
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+    private:
+        sqlite3_stmt* stmt;
+    };
 
-        return (int)sqlite3_last_insert_rowid(db);
+    StatementCache() : hits(0), misses(0) {
+        entries.fill(nullptr);
     }
-    // Получение пользователя по ID
-    User getUserById(int id) {
-        string sql =
-            "SELECT id_user, username, password_hash, role, is_active "
-            "FROM users WHERE id_user = ?;";
-
-        sqlite3_stmt* stmt = nullptr;
-        User u;
+    ~StatementCache() { clear(); }
 
-        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-        sqlite3_bind_int(stmt, 1, id);
+    Statement acquire(sqlite3* db, Query id) {
+        sqlite3_stmt*& stmt = entries[(int)id];
 
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            u.id_user = sqlite3_column_int(stmt, 0);
-            u.username = (const char*)sqlite3_column_text(stmt, 1);
-            u.password_hash = (const char*)sqlite3_column_text(stmt, 2);
-            u.role = (const char*)sqlite3_column_text(stmt, 3);
-            u.is_active = sqlite3_column_int(stmt, 4);
+        if (stmt) {
+            hits++;
         }
         else {
-            sqlite3_finalize(stmt);
-            throw DatabaseException("Пользователь не найден");
+            int rc = sqlite3_prepare_v3(db, querySql(id), -1,
+                SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+            if (rc != SQLITE_OK) {
+                stmt = nullptr;
+                throw DatabaseException("Ошибка подготовки запроса: " +
+                    string(sqlite3_errmsg(db)));
+            }
+            misses++;
         }
+        return Statement(stmt);
+    }
 
-        sqlite3_finalize(stmt);
-        return u;
+    // Освобождение всех запросов (обязательно до sqlite3_close)
+    void clear() {
+        for (auto& stmt : entries) {
+            if (stmt) {
+                sqlite3_finalize(stmt);
+                stmt = nullptr;
+            }
+        }
     }
-    // Получение пользователя по имени
-    User getUserByUsername(const string& username) {
-        string sql =
-            "SELECT id_user, username, password_hash, role, is_active "
-            "FROM users WHERE username = ?;";
 
-        sqlite3_stmt* stmt = nullptr;
-        User user;
+    Stats stats() const {
+        return { hits.load(), misses.load() };
+    }
 
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-        if (rc != SQLITE_OK)
-            throw DatabaseException(sqlite3_errmsg(db));
+private:
+    array<sqlite3_stmt*, (size_t)Query::Count> entries;
+    atomic<uint64_t> hits;
+    atomic<uint64_t> misses;
+};
 
-        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+// Соединение с базой данных вместе с его кэшем запросов
+struct Connection {
+    sqlite3* handle = nullptr;
+    StatementCache statements;
+};
 
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            user.id_user = sqlite3_column_int(stmt, 0);
-            user.username = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-            user.password_hash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-            user.role = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-            user.is_active = sqlite3_column_int(stmt, 4);
+// Пул соединений: одно соединение для записи и несколько соединений
+// только для чтения в режиме WAL, которые выдаются на время одного вызова
+class ConnectionPool {
+public:
+    // Соединение, выданное из пула; при уничтожении возвращается обратно
+    class Lease {
+    public:
+        Lease(ConnectionPool* pool, Connection* conn, unique_lock<mutex>&& writerLock)
+            : pool(pool), conn(conn), writerLock(move(writerLock)) {}
+        Lease(Lease&& other) noexcept
+            : pool(other.pool), conn(other.conn), writerLock(move(other.writerLock)) {
+            other.conn = nullptr;
         }
-        else {
-            sqlite3_finalize(stmt);
-            throw DatabaseException("Пользователь не найден");
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ~Lease() {
+            if (conn && !writerLock.owns_lock()) {
+                pool->releaseReader(conn);
+            }
         }
 
-        sqlite3_finalize(stmt);
-        return user;
-    }
-    // Получение всех пользователей
-    vector<User> getAllUsers() {
-        string sql =
-            "SELECT id_user, username, password_hash, role, is_active "
-            "FROM users ORDER BY username;";
+        sqlite3* handle() const { return conn->handle; }
 
-        vector<User> users;
-        sqlite3_stmt* stmt = nullptr;
+        StatementCache::Statement prepare(Query id) {
+            return conn->statements.acquire(conn->handle, id);
+        }
 
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-        if (rc != SQLITE_OK)
-            throw DatabaseException(sqlite3_errmsg(db));
+    private:
+        ConnectionPool* pool;
+        Connection* conn;
+        unique_lock<mutex> writerLock;
+    };
+
+    // Место потоковой выдачи: курсор, отдаваемый клиенту chunked-ответом,
+    // держит соединение для чтения и снимок WAL все время передачи.
+    // Таких курсоров одновременно не больше половины читателей, чтобы
+    // медленные клиенты не заняли весь пул
+    class StreamSlot {
+    public:
+        explicit StreamSlot(ConnectionPool* pool) : pool(pool) {}
+        StreamSlot(StreamSlot&& other) noexcept : pool(other.pool) {
+            other.pool = nullptr;
+        }
+        StreamSlot(const StreamSlot&) = delete;
+        StreamSlot& operator=(const StreamSlot&) = delete;
 
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            User user;
-            user.id_user = sqlite3_column_int(stmt, 0);
-            user.username = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-            user.password_hash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-            user.role = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-            user.is_active = sqlite3_column_int(stmt, 4);
-            users.push_back(user);
+        ~StreamSlot() {
+            if (pool) pool->releaseStream();
         }
 
-        sqlite3_finalize(stmt);
-        return users;
+    private:
+        ConnectionPool* pool;
+    };
+
+    ConnectionPool() : activeStreams(0), maxStreams(0) {}
+    ~ConnectionPool() { close(); }
+
+    // Открытие соединения для записи; включает WAL, чтобы читатели не блокировались
+    void openWriter(const string& path) {
+        writer.handle = openHandle(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+        execute(writer.handle, "PRAGMA journal_mode = WAL;");
+        // FULL: подтвержденная транзакция переживает отключение питания (на этом
+        // держится WaitForFlush журнала аудита); стоимость fsync делят операции
+        // одного пакета WriteQueue
+        execute(writer.handle, "PRAGMA synchronous = FULL;");
+        execute(writer.handle, "PRAGMA foreign_keys = ON;");
     }
-    // Проверка существования пользователя
-    bool userExists(const string& username) {
-        string sql = "SELECT COUNT(*) FROM users WHERE username = ?;";
-        sqlite3_stmt* stmt = nullptr;
 
-        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+    // Открытие соединений для чтения (после создания схемы)
+    void openReaders(const string& path, size_t count) {
+        lock_guard<mutex> lock(readersMutex);
+        for (size_t i = 0; i < count; i++) {
+            auto conn = make_unique<Connection>();
+            conn->handle = openHandle(path, SQLITE_OPEN_READONLY);
+            freeReaders.push_back(conn.get());
+            readers.push_back(move(conn));
+        }
+        maxStreams = max<size_t>(1, readers.size() / 2);
+    }
+
+    void close() {
+        {
+            lock_guard<mutex> lock(readersMutex);
+            for (auto& conn : readers) {
+                closeHandle(*conn);
+            }
+            readers.clear();
+            freeReaders.clear();
+        }
+        lock_guard<mutex> lock(writerMutex);
+        closeHandle(writer);
+    }
 
-        int count = 0;
-        if (sqlite3_step(stmt) == SQLITE_ROW)
-            count = sqlite3_column_int(stmt, 0);
+    bool isOpen() const { return writer.handle != nullptr; }
 
-        sqlite3_finalize(stmt);
-        return count > 0;
+    // Единственное соединение для записи
+    Lease acquireWriter() {
+        unique_lock<mutex> lock(writerMutex);
+        if (!writer.handle) {
+            throw DatabaseException("База данных не открыта");
+        }
+        return Lease(this, &writer, move(lock));
     }
 
+    // Свободное соединение для чтения; при отсутствии читателей используется писатель.
+    // Ожидание ограничено READER_WAIT: пул занят дольше - DatabaseBusyException,
+    // чтобы потоки сервера не зависали и клиент получил 503
+    Lease acquireReader() {
+        unique_lock<mutex> lock(readersMutex);
+        if (readers.empty()) {
+            lock.unlock();
+            return acquireWriter();
+        }
+        if (!readerAvailable.wait_for(lock, READER_WAIT, [this] { return !freeReaders.empty(); })) {
+            throw DatabaseBusyException("Нет свободного соединения с базой данных, повторите запрос позже");
+        }
+        Connection* conn = freeReaders.back();
+        freeReaders.pop_back();
+        return Lease(this, conn, unique_lock<mutex>());
+    }
 
+    // Место для потоковой выдачи; все заняты - DatabaseBusyException без ожидания
+    StreamSlot acquireStreamSlot() {
+        lock_guard<mutex> lock(readersMutex);
+        if (activeStreams >= maxStreams) {
+            throw DatabaseBusyException("Слишком много одновременных выгрузок, повторите запрос позже");
+        }
+        activeStreams++;
+        return StreamSlot(this);
+    }
 
-    // Добавление нового секрета
-    int addSecret(const Secret& secret) {
-        if (!userExists(getUserById(secret.owner_id).username)) {
-            throw DatabaseException("Владелец секрета не существует");
+    StatementCache::Stats statementStats() {
+        StatementCache::Stats total = writer.statements.stats();
+        lock_guard<mutex> lock(readersMutex);
+        for (auto& conn : readers) {
+            auto s = conn->statements.stats();
+            total.hits += s.hits;
+            total.misses += s.misses;
         }
-        string sql =
-            "INSERT INTO secrets (owner_id, secret_value, expires_at, secret_type) "
-            "VALUES (?, ?, ?, ?);";
+        return total;
+    }
 
-        sqlite3_stmt* stmt;
-        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+    size_t readerCount() {
+        lock_guard<mutex> lock(readersMutex);
+        return readers.size();
+    }
 
-        sqlite3_bind_int(stmt, 1, secret.owner_id);
-        sqlite3_bind_text(stmt, 2, secret.secret_value.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 3, secret.expires_at.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 4, secret.secret_type.c_str(), -1, SQLITE_TRANSIENT);
+private:
+    static constexpr chrono::milliseconds READER_WAIT{ 5000 };     // как busy_timeout соединений
+
+    Connection writer;
+    mutex writerMutex;
+    vector<unique_ptr<Connection>> readers;
+    vector<Connection*> freeReaders;
+    mutex readersMutex;
+    condition_variable readerAvailable;
+    size_t activeStreams;
+    size_t maxStreams;
+
+    void releaseStream() {
+        lock_guard<mutex> lock(readersMutex);
+        activeStreams--;
+    }
 
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+    void releaseReader(Connection* conn) {
+        {
+            lock_guard<mutex> lock(readersMutex);
+            freeReaders.push_back(conn);
+        }
+        readerAvailable.notify_one();
+    }
 
-        return (int)sqlite3_last_insert_rowid(db);
+    static sqlite3* openHandle(const string& path, int flags) {
+        sqlite3* handle = nullptr;
+        int rc = sqlite3_open_v2(path.c_str(), &handle, flags | SQLITE_OPEN_NOMUTEX, nullptr);
+        if (rc != SQLITE_OK) {
+            string error = handle ? sqlite3_errmsg(handle) : "out of memory";
+            sqlite3_close(handle);
+            throw DatabaseException("Не удалось открыть базу данных: " + error);
+        }
+        sqlite3_busy_timeout(handle, 5000);
+        // now_micros() - текущее время для сравнения со столбцами времени
+        sqlite3_create_function_v2(handle, "now_micros", 0, SQLITE_UTF8 | SQLITE_INNOCUOUS,
+            nullptr, nowMicrosFunction, nullptr, nullptr, nullptr);
+        return handle;
     }
-    //Проверка существования секрета
-    bool secretExists(int secretId) {
-        string sql = "SELECT COUNT(*) FROM secrets WHERE id_secrets = ?;";
-        sqlite3_stmt* stmt = nullptr;
 
-        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-        sqlite3_bind_int(stmt, 1, secretId);
+    static void nowMicrosFunction(sqlite3_context* context, int, sqlite3_value**) {
+        sqlite3_result_int64(context, timestamp::nowMicros());
+    }
 
-        int count = 0;
-        if (sqlite3_step(stmt) == SQLITE_ROW)
-            count = sqlite3_column_int(stmt, 0);
+    static void closeHandle(Connection& conn) {
+        if (conn.handle) {
+            conn.statements.clear();
+            sqlite3_close(conn.handle);
+            conn.handle = nullptr;
+        }
+    }
 
-        sqlite3_finalize(stmt);
-        return count > 0;
+    static void execute(sqlite3* handle, const char* sql) {
+        char* errMsg = nullptr;
+        if (sqlite3_exec(handle, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+            string error = errMsg ? errMsg : "Unknown error";
+            sqlite3_free(errMsg);
+            throw DatabaseException("Ошибка выполнения SQL: " + error);
+        }
     }
-    // Получение секрета по ID
-    Secret getSecretById(int secretId) {
-        if (!secretExists(secretId)) {
-            throw DatabaseException("Секрет не существует");
+};
+
+// Версии данных для условных GET (ETag): растут при каждом зафиксированном
+// изменении таблицы, владельца или отдельного секрета и читаются без
+// обращения к SQLite. Владельцы и секреты хешируются в SLOTS счетчиков -
+// совпадение слотов дает лишний промах, но не устаревший ответ.
+// Операции записи отмечают изменения в потоке записи (note*), WriteQueue
+// публикует их после COMMIT, до возврата результатов вызывающим: чтение,
+// начатое после записи, уже видит новую версию
+class ChangeVersions {
+public:
+    static constexpr size_t SLOTS = 4096;
+
+    ChangeVersions() : started(timestamp::nowMicros()), secrets(0), users(0),
+        ownerSlots(new atomic<uint64_t>[SLOTS]), secretSlots(new atomic<uint64_t>[SLOTS]),
+        usersPending(false), allSecretsPending(false) {
+        for (size_t i = 0; i < SLOTS; i++) {
+            ownerSlots[i] = 0;
+            secretSlots[i] = 0;
         }
-        string sql =
-            "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
-            "FROM secrets WHERE id_secrets = ?;";
+    }
 
-        sqlite3_stmt* stmt = nullptr;
-        Secret s;
+    // Счетчики живут в памяти: после перезапуска версии начинаются заново,
+    // поэтому в ETag входит и время запуска
+    int64_t epoch() const { return started; }
 
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-        if (rc != SQLITE_OK)
-            throw DatabaseException(sqlite3_errmsg(db));
+    uint64_t secretsVersion() const { return secrets.load(); }
+    uint64_t usersVersion() const { return users.load(); }
+    uint64_t ownerVersion(int ownerId) const { return ownerSlots[slot(ownerId)].load(); }
+    uint64_t secretVersion(int secretId) const { return secretSlots[slot(secretId)].load(); }
 
-        sqlite3_bind_int(stmt, 1, secretId);
+    // Только из операций WriteQueue
+    void noteSecret(int secretId, int ownerId) {
+        pendingSecrets.emplace_back(secretId, ownerId);
+    }
+    void noteUser() {
+        usersPending = true;
+    }
+    // Очистка таблицы: меняются все владельцы и секреты
+    void noteAllSecrets() {
+        allSecretsPending = true;
+    }
 
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            s.id_secrets = sqlite3_column_int(stmt, 0);
-            s.owner_id = sqlite3_column_int(stmt, 1);
-            s.secret_value = (const char*)sqlite3_column_text(stmt, 2);
-            s.created_at = (const char*)sqlite3_column_text(stmt, 3);
-            s.expires_at = (const char*)sqlite3_column_text(stmt, 4);
-            s.secret_type = (const char*)sqlite3_column_text(stmt, 5);
+    // Транзакция пакета зафиксирована / откачена
+    void publish() {
+        if (allSecretsPending) {
+            for (size_t i = 0; i < SLOTS; i++) {
+                secretSlots[i]++;
+                ownerSlots[i]++;
+            }
         }
         else {
-            sqlite3_finalize(stmt);
-            throw DatabaseException("Секрет не найден");
+            for (auto& change : pendingSecrets) {
+                secretSlots[slot(change.first)]++;
+                ownerSlots[slot(change.second)]++;
+            }
         }
+        if (allSecretsPending || !pendingSecrets.empty()) secrets++;
+        if (usersPending) users++;
+        discard();
+    }
+    void discard() {
+        pendingSecrets.clear();
+        usersPending = false;
+        allSecretsPending = false;
+    }
 
-        sqlite3_finalize(stmt);
-        return s;
+private:
+    int64_t started;
+    atomic<uint64_t> secrets;
+    atomic<uint64_t> users;
+    unique_ptr<atomic<uint64_t>[]> ownerSlots;
+    unique_ptr<atomic<uint64_t>[]> secretSlots;
+    vector<pair<int, int>> pendingSecrets;      // (id секрета, владелец)
+    bool usersPending;
+    bool allSecretsPending;
+
+    static size_t slot(int key) {
+        return (size_t)(unsigned)key % SLOTS;
     }
-    // Получение секрета по пользователю
-    vector<Secret> getSecretsByUser(int userId) {
-        vector<Secret> list;
-        const char* sql =
-            "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
-            "FROM secrets WHERE owner_id = ?;";
+};
 
-        sqlite3_stmt* stmt;
-        sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
-        sqlite3_bind_int(stmt, 1, userId);
+// Очередь операций записи: обработчики добавляют операции из любых потоков,
+// единственный поток-писатель выполняет их пакетами в одной транзакции
+// (group commit) и возвращает каждому вызывающему его результат через future
+class WriteQueue {
+public:
+    // Операция получает соединение для записи и возвращает rowid или число изменений
+    using Operation = function<long long(ConnectionPool::Lease&)>;
+
+    struct Stats {
+        uint64_t batches;
+        uint64_t operations;
+        size_t queueDepth;
+    };
+
+    explicit WriteQueue(ConnectionPool& pool, ChangeVersions& changes, size_t maxBatch = 256)
+        : pool(pool), changes(changes), maxBatch(maxBatch), stopping(false), batches(0), operations(0) {}
+    ~WriteQueue() { stop(); }
+
+    void start() {
+        lock_guard<mutex> lock(queueMutex);
+        if (worker.joinable()) return;
+        stopping = false;
+        worker = thread(&WriteQueue::run, this);
+    }
 
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            Secret s;
-            s.id_secrets = sqlite3_column_int(stmt, 0);
-            s.owner_id = sqlite3_column_int(stmt, 1);
-            s.secret_value = (const char*)sqlite3_column_text(stmt, 2);
-            s.created_at = (const char*)sqlite3_column_text(stmt, 3);
-            s.expires_at = (const char*)sqlite3_column_text(stmt, 4);
-            s.secret_type = (const char*)sqlite3_column_text(stmt, 5);
-            list.push_back(s);
+    // Остановка после выполнения всех уже поставленных операций
+    void stop() {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
         }
+        queueReady.notify_all();
+        if (worker.joinable()) worker.join();
+    }
 
-        sqlite3_finalize(stmt);
-        return list;
+    future<long long> submit(Operation op) {
+        Request request{ move(op), promise<long long>() };
+        future<long long> result = request.result.get_future();
+        {
+            lock_guard<mutex> lock(queueMutex);
+            if (!worker.joinable() || stopping) {
+                throw DatabaseException("Поток записи не запущен");
+            }
+            queue.push_back(move(request));
+        }
+        queueReady.notify_one();
+        return result;
     }
-    // Получение всех секретов
-    vector<Secret> getAllSecrets() {
-        string sql =
-            "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
-            "FROM secrets ORDER BY created_at DESC;";
 
-        vector<Secret> secrets;
-        sqlite3_stmt* stmt = nullptr;
+    Stats stats() {
+        lock_guard<mutex> lock(queueMutex);
+        return { batches.load(), operations.load(), queue.size() };
+    }
+
+private:
+    struct Request {
+        Operation op;
+        promise<long long> result;
+    };
+
+    ConnectionPool& pool;
+    ChangeVersions& changes;
+    size_t maxBatch;
+    deque<Request> queue;
+    mutex queueMutex;
+    condition_variable queueReady;
+    thread worker;
+    bool stopping;
+    atomic<uint64_t> batches;
+    atomic<uint64_t> operations;
+
+    void run() {
+        vector<Request> batch;
+        while (true) {
+            {
+                unique_lock<mutex> lock(queueMutex);
+                queueReady.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                while (!queue.empty() && batch.size() < maxBatch) {
+                    batch.push_back(move(queue.front()));
+                    queue.pop_front();
+                }
+            }
+            executeBatch(batch);
+            batch.clear();
+        }
+    }
 
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-        if (rc != SQLITE_OK)
-            throw DatabaseException(sqlite3_errmsg(db));
+    // Все операции пакета выполняются в одной транзакции; каждая - внутри
+    // своей точки сохранения, чтобы ошибка одной не откатывала остальные
+    void executeBatch(vector<Request>& batch) {
+        vector<long long> results(batch.size());
+        vector<exception_ptr> errors(batch.size());
 
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            Secret s;
-            s.id_secrets = sqlite3_column_int(stmt, 0);
-            s.owner_id = sqlite3_column_int(stmt, 1);
-            s.secret_value = (const char*)sqlite3_column_text(stmt, 2);
-            s.created_at = (const char*)sqlite3_column_text(stmt, 3);
-            s.expires_at = (const char*)sqlite3_column_text(stmt, 4);
-            s.secret_type = (const char*)sqlite3_column_text(stmt, 5);
-            secrets.push_back(s);
+        try {
+            auto conn = pool.acquireWriter();
+            try {
+                step(conn, Query::BeginImmediate);
+
+                for (size_t i = 0; i < batch.size(); i++) {
+                    step(conn, Query::Savepoint);
+                    try {
+                        results[i] = batch[i].op(conn);
+                        step(conn, Query::ReleaseSavepoint);
+                    }
+                    catch (const DatabaseException&) {
+                        errors[i] = current_exception();
+                        step(conn, Query::RollbackToSavepoint);
+                        step(conn, Query::ReleaseSavepoint);
+                    }
+                }
+
+                step(conn, Query::Commit);
+            }
+            catch (...) {
+                if (!sqlite3_get_autocommit(conn.handle())) {
+                    sqlite3_exec(conn.handle(), "ROLLBACK;", nullptr, nullptr, nullptr);
+                }
+                throw;
+            }
+        }
+        catch (...) {
+            // Транзакция не зафиксирована - ошибка для всего пакета
+            changes.discard();
+            exception_ptr error = current_exception();
+            for (auto& request : batch) {
+                request.result.set_exception(error);
+            }
+            return;
         }
 
-        sqlite3_finalize(stmt);
-        return secrets;
+        // Откаченные до точки сохранения операции тоже могли отметить
+        // изменения - лишнее увеличение версии безопасно
+        changes.publish();
+        batches++;
+        operations += batch.size();
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (errors[i]) batch[i].result.set_exception(errors[i]);
+            else batch[i].result.set_value(results[i]);
+        }
     }
-    //Обновление секрета
-    bool updateSecret(int secretId, const Secret& s) {
-        if (!secretExists(secretId)) {
-            throw DatabaseException("Нельзя обновить несуществующий секрет");
+
+    static void step(ConnectionPool::Lease& conn, Query id) {
+        StatementCache::Statement stmt = conn.prepare(id);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            throw DatabaseException("Ошибка выполнения SQL: " +
+                string(sqlite3_errmsg(conn.handle())));
         }
-        string sql =
-            "UPDATE secrets SET secret_value = ?, expires_at = ?, secret_type = ? "
-            "WHERE id_secrets = ?;";
+    }
+};
 
-        sqlite3_stmt* stmt = nullptr;
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-        if (rc != SQLITE_OK)
-            throw DatabaseException("Ошибка подготовки запроса");
+// Потоковый курсор по результату запроса: строки читаются из живого
+// sqlite3_stmt по одной, без накопления в векторе. Пока курсор жив,
+// он удерживает соединение для чтения; курсор, который отдается клиенту
+// по сети, дополнительно занимает ConnectionPool::StreamSlot
+template<typename T>
+class RowCursor {
+public:
+    using Reader = T(*)(sqlite3_stmt*);
+
+    class iterator {
+    public:
+        using iterator_category = input_iterator_tag;
+        using value_type = T;
+        using difference_type = ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        explicit iterator(RowCursor* cursor) : cursor(cursor) {
+            if (cursor && !cursor->next()) this->cursor = nullptr;
+        }
+        const T& operator*() const { return cursor->current; }
+        const T* operator->() const { return &cursor->current; }
+        iterator& operator++() {
+            if (!cursor->next()) cursor = nullptr;
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return cursor == other.cursor; }
+        bool operator!=(const iterator& other) const { return cursor != other.cursor; }
+
+    private:
+        RowCursor* cursor;
+    };
+
+    RowCursor(ConnectionPool::Lease&& lease, Query id, Reader read)
+        : lease(move(lease)), stmt(this->lease.prepare(id)), read(read), finished(false) {}
+    RowCursor(RowCursor&&) = default;
+
+    // Запрос для привязки параметров до начала чтения
+    sqlite3_stmt* statement() const { return stmt; }
+
+    // Переход к следующей строке; false - строки закончились
+    bool next() {
+        if (finished) return false;
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            current = read(stmt);
+            return true;
+        }
+        finished = true;
+        if (rc != SQLITE_DONE) {
+            throw DatabaseException("Ошибка чтения строки: " +
+                string(sqlite3_errmsg(lease.handle())));
+        }
+        return false;
+    }
 
-        sqlite3_bind_text(stmt, 1, s.secret_value.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 2, s.expires_at.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 3, s.secret_type.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_int(stmt, 4, secretId);
+    const T& row() const { return current; }
 
-        bool success = (sqlite3_step(stmt) == SQLITE_DONE);
-        sqlite3_finalize(stmt);
-        return success;
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(nullptr); }
+
+private:
+    ConnectionPool::Lease lease;
+    StatementCache::Statement stmt;
+    Reader read;
+    T current;
+    bool finished;
+};
+
+class DataBase {
+private:
+    using Statement = StatementCache::Statement;
+
+    ConnectionPool pool;
+    ChangeVersions changes;
+    WriteQueue writes;
+    string dbPath;
+    DataBase() : writes(pool, changes) {}
+
+public:
+    // Singleton - получение единственного экземпляра
+    static DataBase& getInstance() {
+        static DataBase instance;
+        return instance;
     }
-    //Поиск секретов
-    vector<Secret> searchSecrets(const string& pattern) {
-        string sql =
-            "SELECT id_secrets, owner_id, secret_value, created_at, expires_at, secret_type "
-            "FROM secrets WHERE secret_value LIKE ? OR secret_type LIKE ?;";
 
-        vector<Secret> list;
-        sqlite3_stmt* stmt = nullptr;
-        string p = "%" + pattern + "%";
+    ~DataBase() {
+        close();
+                }
 
-        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-        sqlite3_bind_text(stmt, 1, p.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 2, p.c_str(), -1, SQLITE_TRANSIENT);
+    // Открытие базы данных; readers - число соединений для чтения (0 - по числу ядер)
+    bool open(const string& path, size_t readers = 0) {
+        dbPath = path;
+        pool.openWriter(path);
+        migrate();
+        verifyQueryPlans();
+        if (readers == 0) {
+            readers = max(2u, thread::hardware_concurrency());
+        }
+        pool.openReaders(path, readers);
+        writes.start();
+        cout << "База данных открыта: " << path << endl;
+        return true;
+    }
 
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            Secret s;
-            s.id_secrets = sqlite3_column_int(stmt, 0);
-            s.owner_id = sqlite3_column_int(stmt, 1);
-            s.secret_value = (const char*)sqlite3_column_text(stmt, 2);
-            s.created_at = (const char*)sqlite3_column_text(stmt, 3);
-            s.expires_at = (const char*)sqlite3_column_text(stmt, 4);
-            s.secret_type = (const char*)sqlite3_column_text(stmt, 5);
-            list.push_back(s);
+    // Закрытие базы данных
+    void close() {
+        if (pool.isOpen()) {
+            writes.stop();
+            pool.close();
+            cout << "База данных закрыта" << endl;
         }
+    }
 
-        sqlite3_finalize(stmt);
-        return list;
+    // Статистика кэша подготовленных запросов (по всем соединениям)
+    StatementCache::Stats getStatementCacheStats() {
+        return pool.statementStats();
     }
 
-    // Удаление секрета по ID
-    bool deleteSecret(int secretId) {
-        string sql = "DELETE FROM tbl_secret WHERE id = ?;";
+    // Текущая версия схемы базы данных
+    int getSchemaVersion() {
+        return executeScalar<int>(Query::SchemaVersion);
+    }
 
-        sqlite3_stmt* stmt = nullptr;
+    // Статистика потока записи
+    WriteQueue::Stats getWriteQueueStats() {
+        return writes.stats();
+    }
 
-        try {
-            int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-            if (rc != SQLITE_OK) {
-                throw DatabaseException("Ошибка подготовки запроса");
+    // Версии данных для ETag
+    const ChangeVersions& getChangeVersions() const {
+        return changes;
+    }
+
+    // Место для потоковой выдачи клиенту (см. ConnectionPool::StreamSlot)
+    ConnectionPool::StreamSlot acquireStreamSlot() {
+        return pool.acquireStreamSlot();
+    }
+
+    // Количество соединений для чтения
+    size_t getReaderCount() {
+        return pool.readerCount();
+    }
+
+    // Добовление нового пользователя; занятое имя отклоняет уникальный индекс
+    // username (ConflictException)
+    future<long long> addUserAsync(const User& user) {
+        return writes.submit([this, user](ConnectionPool::Lease& conn) {
+            Statement stmt = conn.prepare(Query::AddUser);
+
+            sqlite3_bind_text(stmt, 1, user.username.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt, 2, user.password_hash.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt, 3, user.role.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int(stmt, 4, user.is_active);
+            sqlite3_bind_int64(stmt, 5, timestamp::nowMicros());
+
+            try {
+                stepWrite(conn, stmt);
+            }
+            catch (const ConflictException&) {
+                throw ConflictException("Пользователь с таким именем уже существует");
             }
 
-            sqlite3_bind_int(stmt, 1, secretId);
+            changes.noteUser();
+            return (long long)sqlite3_last_insert_rowid(conn.handle());
+            });
+    }
+    int addUser(const User& user) {
+        return (int)addUserAsync(user).get();
+    }
+    // Получение пользователя по ID
+    User getUserById(int id) {
+        auto conn = pool.acquireReader();
+        Statement stmt = conn.prepare(Query::GetUserById);
+        User u;
+
+        sqlite3_bind_int(stmt, 1, id);
+
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            u = readUser(stmt);
+        }
+        else {
+            throw NotFoundException("Пользователь не найден");
+        }
+
+        return u;
+    }
+    // Получение пользователя по имени
+    User getUserByUsername(const string& username) {
+        auto conn = pool.acquireReader();
+        Statement stmt = conn.prepare(Query::GetUserByUsername);
+        User user;
+
+        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            user = readUser(stmt);
+        }
+        else {
+            throw NotFoundException("Пользователь не найден");
+        }
+
+        return user;
+    }
+    // Получение всех пользователей
+    vector<User> getAllUsers() {
+        return collect(streamAllUsers());
+    }
+    RowCursor<User> streamAllUsers() {
+        return RowCursor<User>(pool.acquireReader(), Query::GetAllUsers, readUser);
+    }
+    // Курсор по одному пользователю (для потоковой выдачи списка из одной строки)
+    RowCursor<User> streamUserByUsername(const string& username) {
+        RowCursor<User> rows(pool.acquireReader(), Query::GetUserByUsername, readUser);
+        sqlite3_bind_text(rows.statement(), 1, username.c_str(), -1, SQLITE_TRANSIENT);
+        return rows;
+    }
+
+
+
+    // Добавление нового секрета; владельца проверяет внешний ключ owner_id
+    // (ForeignKeyException)
+    future<long long> addSecretAsync(const Secret& secret) {
+        return writes.submit([this, secret](ConnectionPool::Lease& conn) {
+            Statement stmt = conn.prepare(Query::AddSecret);
+
+            sqlite3_bind_int(stmt, 1, secret.owner_id);
+            sqlite3_bind_text(stmt, 2, secret.secret_value.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(stmt, 3, secret.expires_at);
+            sqlite3_bind_text(stmt, 4, secret.secret_type.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(stmt, 5, timestamp::nowMicros());
+
+            stepAddSecret(conn, stmt);
+
+            long long id = sqlite3_last_insert_rowid(conn.handle());
+            changes.noteSecret((int)id, secret.owner_id);
+            return id;
+            });
+    }
+    int addSecret(const Secret& secret) {
+        return (int)addSecretAsync(secret).get();
+    }
+
+    // Секреты, срок действия которых истекает в ближайшие horizon секунд
+    // (и уже истекшие), по возрастанию срока: пары (id, срок в микросекундах Unix)
+    vector<pair<int, int64_t>> getExpiringSecrets(chrono::seconds horizon, size_t limit) {
+        auto conn = pool.acquireReader();
+        Statement stmt = conn.prepare(Query::ExpiringSecrets);
 
-            rc = sqlite3_step(stmt);
-            bool success = (rc == SQLITE_DONE);
+        sqlite3_bind_int64(stmt, 1, chrono::duration_cast<chrono::microseconds>(horizon).count());
+        sqlite3_bind_int64(stmt, 2, (sqlite3_int64)limit);
 
-            if (success) {
-                cout << "Секрет ID " << secretId << " удален" << endl;
+        vector<pair<int, int64_t>> result;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            result.emplace_back(sqlite3_column_int(stmt, 0), sqlite3_column_int64(stmt, 1));
+        }
+        return result;
+    }
+
+    // Удаление истекших секретов одной транзакцией. Срок проверяется заново:
+    // секрет, продленный после постановки в очередь, не удаляется.
+    // Возвращает id действительно удаленных секретов
+    vector<int> deleteExpiredSecrets(const vector<int>& ids) {
+        auto deleted = make_shared<vector<int>>();
+        writes.submit([this, ids, deleted](ConnectionPool::Lease& conn) {
+            for (int id : ids) {
+                Statement stmt = conn.prepare(Query::DeleteExpiredSecret);
+                sqlite3_bind_int(stmt, 1, id);
+                if (auto owner = stepReturningInt(conn, stmt)) {
+                    changes.noteSecret(id, *owner);
+                    deleted->push_back(id);
+                }
             }
-            else {
-                cerr << "Ошибка удаления секрета" << endl;
+            return (long long)deleted->size();
+            }).get();
+        return *deleted;
+    }
+
+    // Результат импорта одного секрета: id или текст ошибки
+    struct ImportResult {
+        int id_secrets;
+        string error;
+    };
+
+    // Пакетный импорт: все секреты и записи аудита о них - в одной транзакции.
+    // Владельца проверяет внешний ключ; ошибка одного элемента откатывает
+    // только его (вложенная точка сохранения)
+    vector<ImportResult> addSecretsBatch(const vector<Secret>& secrets, const string& auditAction) {
+        auto results = make_shared<vector<ImportResult>>(secrets.size(), ImportResult{ 0, "" });
+        writes.submit([this, secrets, auditAction, results](ConnectionPool::Lease& conn) {
+            long long added = 0;
+            int64_t now = timestamp::nowMicros();
+
+            for (size_t i = 0; i < secrets.size(); i++) {
+                const Secret& secret = secrets[i];
+
+                stepWrite(conn, conn.prepare(Query::ItemSavepoint));
+                try {
+                    Statement stmt = conn.prepare(Query::AddSecret);
+                    sqlite3_bind_int(stmt, 1, secret.owner_id);
+                    sqlite3_bind_text(stmt, 2, secret.secret_value.c_str(), -1, SQLITE_TRANSIENT);
+                    sqlite3_bind_int64(stmt, 3, secret.expires_at);
+                    sqlite3_bind_text(stmt, 4, secret.secret_type.c_str(), -1, SQLITE_TRANSIENT);
+                    sqlite3_bind_int64(stmt, 5, now);
+                    stepAddSecret(conn, stmt);
+                    int id = (int)sqlite3_last_insert_rowid(conn.handle());
+
+                    Statement audit = conn.prepare(Query::AddAuditLog);
+                    sqlite3_bind_int(audit, 1, secret.owner_id);
+                    sqlite3_bind_text(audit, 2, auditAction.c_str(), -1, SQLITE_TRANSIENT);
+                    sqlite3_bind_text(audit, 3, "secret", -1, SQLITE_STATIC);
+                    sqlite3_bind_int(audit, 4, id);
+                    sqlite3_bind_int64(audit, 5, now);
+                    stepWrite(conn, audit);
+
+                    stepWrite(conn, conn.prepare(Query::ReleaseItemSavepoint));
+                    changes.noteSecret(id, secret.owner_id);
+                    (*results)[i].id_secrets = id;
+                    added++;
+                }
+                catch (const DatabaseException& e) {
+                    (*results)[i].error = e.what();
+                    stepWrite(conn, conn.prepare(Query::RollbackToItemSavepoint));
+                    stepWrite(conn, conn.prepare(Query::ReleaseItemSavepoint));
+                }
             }
+            return added;
+            }).get();
+        return *results;
+    }
+    // Получение секрета по ID
+    // Один запрос: отсутствующий или истекший секрет - NotFoundException
+    Secret getSecretById(int secretId) {
+        auto conn = pool.acquireReader();
+        Statement stmt = conn.prepare(Query::GetSecretById);
 
-            sqlite3_finalize(stmt);
-            return success;
+        sqlite3_bind_int(stmt, 1, secretId);
 
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_DONE) {
+            throw NotFoundException("Секрет не найден");
         }
-        catch (...) {
-            if (stmt) sqlite3_finalize(stmt);
-            throw;
+        if (rc != SQLITE_ROW) {
+            throw DatabaseException("Ошибка чтения секрета: " + string(sqlite3_errmsg(conn.handle())));
+        }
+        return readSecret(stmt);
+    }
+    // Получение секрета по пользователю
+    vector<Secret> getSecretsByUser(int userId) {
+        return collect(streamSecretsByUser(userId));
+    }
+    RowCursor<Secret> streamSecretsByUser(int userId) {
+        RowCursor<Secret> rows(pool.acquireReader(), Query::GetSecretsByUser, readSecret);
+        sqlite3_bind_int(rows.statement(), 1, userId);
+        return rows;
+    }
+    // Получение всех секретов
+    vector<Secret> getAllSecrets() {
+        return collect(streamAllSecrets());
+    }
+    RowCursor<Secret> streamAllSecrets() {
+        return RowCursor<Secret>(pool.acquireReader(), Query::GetAllSecrets, readSecret);
+    }
+    // Выгрузка по возрастанию id, начиная после afterId: прерванную
+    // выгрузку можно продолжить с последнего полученного id
+    RowCursor<Secret> streamSecretsForExport(long long afterId = 0) {
+        RowCursor<Secret> rows(pool.acquireReader(), Query::ExportSecrets, readSecret);
+        sqlite3_bind_int64(rows.statement(), 1, afterId);
+        return rows;
+    }
+    //Обновление секрета; отсутствующий или истекший секрет - NotFoundException
+    future<long long> updateSecretAsync(int secretId, const Secret& s) {
+        return writes.submit([this, secretId, s](ConnectionPool::Lease& conn) {
+            Statement stmt = conn.prepare(Query::UpdateSecret);
+
+            sqlite3_bind_text(stmt, 1, s.secret_value.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(stmt, 2, s.expires_at);
+            sqlite3_bind_text(stmt, 3, s.secret_type.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int(stmt, 4, secretId);
+
+            auto owner = stepReturningInt(conn, stmt);
+            if (!owner) {
+                throw NotFoundException("Нельзя обновить несуществующий секрет");
+            }
+            changes.noteSecret(secretId, *owner);
+            return 1LL;
+            });
+    }
+    bool updateSecret(int secretId, const Secret& s) {
+        return updateSecretAsync(secretId, s).get() > 0;
+    }
+    //Поиск секретов
+    // Поиск идет по индексу secrets_fts (подстрока в secret_value или secret_type,
+    // без учета регистра), результаты упорядочены по релевантности (bm25).
+    // Образцы короче FTS_MIN_PATTERN символов индекс не поддерживает - для них LIKE
+    static constexpr size_t FTS_MIN_PATTERN = 3;
+
+    vector<Secret> searchSecrets(const string& pattern, size_t limit = 0) {
+        return collect(streamSearchSecrets(pattern, limit));
+    }
+    RowCursor<Secret> streamSearchSecrets(const string& pattern, size_t limit = 0) {
+        return searchCursor(pattern, nullopt, limit);
+    }
+    // Поиск только среди секретов владельца
+    vector<Secret> searchSecretsByOwner(int ownerId, const string& pattern, size_t limit = 0) {
+        return collect(searchCursor(pattern, ownerId, limit));
+    }
+
+    static size_t utf8Length(const string& text) {
+        size_t length = 0;
+        for (unsigned char c : text) {
+            if ((c & 0xC0) != 0x80) length++;
         }
+        return length;
+    }
+
+    // Удаление секрета по ID; результат - число удаленных строк (0 - секрета нет)
+    future<long long> deleteSecretAsync(int secretId) {
+        return writes.submit([this, secretId](ConnectionPool::Lease& conn) {
+            Statement stmt = conn.prepare(Query::DeleteSecret);
+
+            sqlite3_bind_int(stmt, 1, secretId);
+
+            auto owner = stepReturningInt(conn, stmt);
+            if (!owner) return 0LL;
+            changes.noteSecret(secretId, *owner);
+            return 1LL;
+            });
+    }
+    // false - секрета нет или удаление не удалось
+    bool deleteSecret(int secretId) {
+        long long changed = 0;
+        try {
+            changed = deleteSecretAsync(secretId).get();
+        }
+        catch (const DatabaseException& e) {
+            cerr << "Ошибка удаления секрета: " << e.what() << endl;
+            return false;
+        }
+        if (changed == 0) return false;
+
+        cout << "Секрет ID " << secretId << " удален" << endl;
+        return true;
     }
 
 
     // Логирование действий
-    void addAuditLog(int userId, const string& action,
+    future<long long> addAuditLogAsync(int userId, const string& action,
         const string& objectType, int objectId) {
-        string sql =
-            "INSERT INTO audit_logs (user_id, action, object_type, object_id) "
-            "VALUES (?, ?, ?, ?);";
+        return writes.submit([=](ConnectionPool::Lease& conn) {
+            Statement stmt = conn.prepare(Query::AddAuditLog);
 
-        sqlite3_stmt* stmt;
-        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+            bindUserId(stmt, 1, userId);
+            sqlite3_bind_text(stmt, 2, action.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt, 3, objectType.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int(stmt, 4, objectId);
+            sqlite3_bind_int64(stmt, 5, timestamp::nowMicros());
 
-        sqlite3_bind_int(stmt, 1, userId);
-        sqlite3_bind_text(stmt, 2, action.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 3, objectType.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_int(stmt, 4, objectId);
+            stepWrite(conn, stmt);
 
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+            return (long long)sqlite3_last_insert_rowid(conn.handle());
+            });
+    }
+    void addAuditLog(int userId, const string& action,
+        const string& objectType, int objectId) {
+        addAuditLogAsync(userId, action, objectType, objectId).get();
+    }
+    // Запись журнала аудита, которую не удалось сохранить: номер в пакете и текст ошибки
+    struct AuditWriteError {
+        size_t index;
+        string error;
+    };
+
+    // Пакетная запись журнала аудита одной операцией записи. Каждая запись -
+    // под своей точкой сохранения: ошибка одной (например, внешнего ключа)
+    // откатывает только ее. Возвращает записи, которые не сохранены
+    vector<AuditWriteError> addAuditLogBatch(const vector<AuditLog>& logs) {
+        auto errors = make_shared<vector<AuditWriteError>>();
+        writes.submit([logs, errors](ConnectionPool::Lease& conn) {
+            long long added = 0;
+            for (size_t i = 0; i < logs.size(); i++) {
+                const AuditLog& log = logs[i];
+
+                stepWrite(conn, conn.prepare(Query::ItemSavepoint));
+                try {
+                    Statement stmt = conn.prepare(Query::AddAuditLog);
+                    bindUserId(stmt, 1, log.user_id);
+                    sqlite3_bind_text(stmt, 2, log.action.c_str(), -1, SQLITE_TRANSIENT);
+                    sqlite3_bind_text(stmt, 3, log.object_type.c_str(), -1, SQLITE_TRANSIENT);
+                    sqlite3_bind_int(stmt, 4, log.object_id);
+                    sqlite3_bind_int64(stmt, 5, log.created_at ? log.created_at : timestamp::nowMicros());
+                    stepWrite(conn, stmt);
+
+                    stepWrite(conn, conn.prepare(Query::ReleaseItemSavepoint));
+                    added++;
+                }
+                catch (const DatabaseException& e) {
+                    errors->push_back({ i, e.what() });
+                    stepWrite(conn, conn.prepare(Query::RollbackToItemSavepoint));
+                    stepWrite(conn, conn.prepare(Query::ReleaseItemSavepoint));
+                }
+            }
+            return added;
+            }).get();
+        return *errors;
     }
     // Аутентификация (проверка пользователя и пароля)
     bool authenticate(const string& username, const string& password_hash) {
-        string sql =
-            "SELECT COUNT(*) FROM users "
-            "WHERE username = ? AND password_hash = ? AND is_active = 1;";
+        auto result = getCredentials(username);
+        return result && result->is_active && result->password_hash == password_hash;
+    }
 
-        sqlite3_stmt* stmt;
-        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+    // Хеш пароля, id, роль и признак активности одним запросом по
+    // уникальному индексу username. nullopt - пользователь не найден
+    optional<AuthResult> getCredentials(const string& username) {
+        auto conn = pool.acquireReader();
+        Statement stmt = conn.prepare(Query::Authenticate);
 
         sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 2, password_hash.c_str(), -1, SQLITE_TRANSIENT);
 
-        int count = 0;
-        if (sqlite3_step(stmt) == SQLITE_ROW)
-            count = sqlite3_column_int(stmt, 0);
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_DONE) return nullopt;
+        if (rc != SQLITE_ROW) {
+            throw DatabaseException("Ошибка аутентификации: " + string(sqlite3_errmsg(conn.handle())));
+        }
 
-        sqlite3_finalize(stmt);
-        return count > 0;
+        AuthResult result;
+        result.id_user = sqlite3_column_int(stmt, 0);
+        result.username = columnText(stmt, 1);
+        result.password_hash = columnText(stmt, 2);
+        result.role = columnText(stmt, 3);
+        result.is_active = sqlite3_column_int(stmt, 4) != 0;
+        return result;
     }
 
+    // Замена хеша пароля (переход на новый формат или стоимость хеширования)
+    future<long long> updatePasswordHashAsync(int userId, const string& password_hash) {
+        return writes.submit([userId, password_hash](ConnectionPool::Lease& conn) {
+            Statement stmt = conn.prepare(Query::UpdatePasswordHash);
 
-    void dropTables() {
-        try {
-            executeSQL("DROP TABLE IF EXISTS secret;");
-            executeSQL("DROP TABLE IF EXISTS users;");
-            executeSQL("DROP TABLE IF EXISTS audit_logs;");
-        }
-        catch (const DatabaseException& e) { cerr << "Ошибка удаления таблиц: " << e.what() << endl; }
-    }
-   
+            sqlite3_bind_text(stmt, 1, password_hash.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int(stmt, 2, userId);
 
-   
+            stepWrite(conn, stmt);
 
+            return (long long)sqlite3_changes(conn.handle());
+            });
+    }
 
-   
 
     // Получение статистики
     struct Statistics {
@@ -531,33 +1685,23 @@ public:
             cout << "Последний активный пользователь: " << lastActiveUser << endl;
             cout << "Первый активный пользователь: " << firstActiveUser << endl;
         }
-    }; 
+    };
+    // Счетчики ведутся триггерами на audit_logs, здесь читается одна строка
     Statistics getStatistics() {
-        Statistics stats;
-
-        // Общее количество действий
-        stats.totalActions = executeScalar<int>(
-            "SELECT COUNT(*) FROM audit_logs;"
-        );
-
-        // Количество уникальных пользователей
-        stats.uniqueUsers = executeScalar<int>(
-            "SELECT COUNT(DISTINCT user_id) FROM audit_logs;"
-        );
-
-        // Последний активный пользователь
-        stats.lastActiveUser = executeScalar<string>(
-            "SELECT u.username FROM audit_logs a "
-            "JOIN users u ON a.user_id = u.id_user "
-            "ORDER BY a.created_at DESC LIMIT 1;"
-        );
-
-        // Первый активный пользователь
-        stats.firstActiveUser = executeScalar<string>(
-            "SELECT u.username FROM audit_logs a "
-            "JOIN users u ON a.user_id = u.id_user "
-            "ORDER BY a.created_at ASC LIMIT 1;"
-        );
+        Statistics stats = { 0, 0, "", "" };
+
+        auto conn = pool.acquireReader();
+        Statement stmt = conn.prepare(Query::Statistics);
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            stats.totalActions = sqlite3_column_int(stmt, 0);
+            stats.uniqueUsers = sqlite3_column_int(stmt, 1);
+            stats.lastActiveUser = columnText(stmt, 2);
+            stats.firstActiveUser = columnText(stmt, 3);
+        }
+        else if (rc != SQLITE_DONE) {
+            throw DatabaseException("Ошибка чтения статистики: " + string(sqlite3_errmsg(conn.handle())));
+        }
 
         return stats;
     }
@@ -571,93 +1715,397 @@ public:
 
     // Очистка всей таблицы
     bool clearAllSecrets() {
-        string sql = "DELETE FROM secret;";
+        writes.submit([this](ConnectionPool::Lease& conn) {
+            Statement stmt = conn.prepare(Query::ClearAllSecrets);
 
-        sqlite3_stmt* stmt = nullptr;
+            stepWrite(conn, stmt);
+            changes.noteAllSecrets();
 
-        try {
-            int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-            if (rc != SQLITE_OK) {
-                throw DatabaseException("Ошибка подготовки запроса");
-            }
+            return (long long)sqlite3_changes(conn.handle());
+            }).get();
+
+        cout << "Все секреты удалены" << endl;
+        return true;
+    }
+    bool clearAllUsers() {
+        writes.submit([this](ConnectionPool::Lease& conn) {
+            Statement stmt = conn.prepare(Query::ClearAllUsers);
 
-            rc = sqlite3_step(stmt);
-            bool success = (rc == SQLITE_DONE);
+            stepWrite(conn, stmt);
+            // Секреты удаляемых пользователей уходят каскадом
+            changes.noteUser();
+            changes.noteAllSecrets();
 
-            if (success) {
-                cout << "Все секреты удалены" << endl;
-            }
+            return (long long)sqlite3_changes(conn.handle());
+            }).get();
 
-            sqlite3_finalize(stmt);
-            return success;
+        cout << "Все пользователи удалены" << endl;
+        return true;
+    }
+    // Постраничная выборка по ключу (created_at, id), от новых к старым.
+    // after - курсор предыдущей страницы; без него выдается первая страница
+    Page<Secret> getSecretsPage(size_t limit, const optional<PageCursor>& after = nullopt) {
+        return fetchPage<Secret>(Query::SecretsPage, Query::SecretsPageAfter,
+            nullopt, limit, after, readSecret,
+            [](const Secret& s) { return PageCursor{ s.created_at, s.id_secrets }; });
+    }
+    Page<Secret> getSecretsByUserPage(int userId, size_t limit,
+        const optional<PageCursor>& after = nullopt) {
+        return fetchPage<Secret>(Query::SecretsByUserPage, Query::SecretsByUserPageAfter,
+            userId, limit, after, readSecret,
+            [](const Secret& s) { return PageCursor{ s.created_at, s.id_secrets }; });
+    }
+    Page<User> getUsersPage(size_t limit, const optional<PageCursor>& after = nullopt) {
+        return fetchPage<User>(Query::UsersPage, Query::UsersPageAfter,
+            nullopt, limit, after, readUser,
+            [](const User& u) { return PageCursor{ u.created_at, u.id_user }; });
+    }
+    Page<AuditLog> getAuditLogsPage(size_t limit, const optional<PageCursor>& after = nullopt) {
+        return fetchPage<AuditLog>(Query::AuditLogsPage, Query::AuditLogsPageAfter,
+            nullopt, limit, after, readAuditLog,
+            [](const AuditLog& l) { return PageCursor{ l.created_at, l.id_audit_logs }; });
+    }
+    Page<AuditLog> getAuditLogsByUserPage(int userId, size_t limit,
+        const optional<PageCursor>& after = nullopt) {
+        AuditFilter filter;
+        filter.userId = userId;
+        return getAuditLogsFilteredPage(filter, limit, after);
+    }
+    // Выборка журнала по фильтру; с userId используется покрывающий индекс,
+    // без него - просмотр idx_audit_created с проверкой фильтров (см. AuditLogsFiltered)
+    Page<AuditLog> getAuditLogsFilteredPage(const AuditFilter& filter, size_t limit,
+        const optional<PageCursor>& after = nullopt) {
+        auto conn = pool.acquireReader();
+        Statement stmt = conn.prepare(filter.userId ? Query::AuditLogsByUserFiltered : Query::AuditLogsFiltered);
+        bindAuditFilter(stmt, filter, after, (sqlite3_int64)limit + 1);
+        return readPage<AuditLog>(stmt, limit, readAuditLog,
+            [](const AuditLog& l) { return PageCursor{ l.created_at, l.id_audit_logs }; });
+    }
 
+    // Получение всех записей журнала аудита
+    vector<AuditLog> getAuditLogs() {
+        return collect(streamAuditLogs());
+    }
+    RowCursor<AuditLog> streamAuditLogs() {
+        return RowCursor<AuditLog>(pool.acquireReader(), Query::GetAuditLogs, readAuditLog);
+    }
+    RowCursor<AuditLog> streamAuditLogsForExport(long long afterId = 0) {
+        RowCursor<AuditLog> rows(pool.acquireReader(), Query::ExportAuditLogs, readAuditLog);
+        sqlite3_bind_int64(rows.statement(), 1, afterId);
+        return rows;
+    }
+    // Журнал аудита одного пользователя (запрос страницы с LIMIT -1 - без ограничения)
+    RowCursor<AuditLog> streamAuditLogsByUser(int userId) {
+        AuditFilter filter;
+        filter.userId = userId;
+        return streamAuditLogsFiltered(filter);
+    }
+    RowCursor<AuditLog> streamAuditLogsFiltered(const AuditFilter& filter) {
+        RowCursor<AuditLog> rows(pool.acquireReader(),
+            filter.userId ? Query::AuditLogsByUserFiltered : Query::AuditLogsFiltered, readAuditLog);
+        bindAuditFilter(rows.statement(), filter, nullopt, -1);
+        return rows;
+    }
+
+private:
+    // Вспомогательные методы
+
+    // Применение недостающих миграций; на актуальной базе - один запрос версии
+    void migrate() {
+        executeSQL(
+            "CREATE TABLE IF NOT EXISTS schema_version ("
+            "version INTEGER PRIMARY KEY,"
+            "description TEXT NOT NULL,"
+            "applied_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP"
+            ");");
+
+        const auto& migrations = schemaMigrations();
+        int current = getSchemaVersion();
+        int latest = migrations.empty() ? 0 : migrations.back().version;
+        if (current > latest) {
+            throw DatabaseException("Версия схемы базы данных (" + to_string(current) +
+                ") новее поддерживаемой (" + to_string(latest) + ")");
         }
-        catch (...) {
-            if (stmt) sqlite3_finalize(stmt);
-            throw;
+
+        for (const auto& m : migrations) {
+            if (m.version <= current) continue;
+
+            auto conn = pool.acquireWriter();
+            // PRAGMA foreign_keys внутри транзакции не действует
+            if (m.rebuildsTables) executeOn(conn.handle(), "PRAGMA foreign_keys = OFF;");
+            try {
+                executeOn(conn.handle(), "BEGIN IMMEDIATE;");
+                executeOn(conn.handle(), m.sql.c_str());
+                if (m.rebuildsTables) checkForeignKeys(conn.handle());
+                {
+                    Statement stmt = conn.prepare(Query::AddSchemaVersion);
+                    sqlite3_bind_int(stmt, 1, m.version);
+                    sqlite3_bind_text(stmt, 2, m.description, -1, SQLITE_STATIC);
+                    stepWrite(conn, stmt);
+                }
+                executeOn(conn.handle(), "COMMIT;");
+            }
+            catch (...) {
+                sqlite3_exec(conn.handle(), "ROLLBACK;", nullptr, nullptr, nullptr);
+                if (m.rebuildsTables) sqlite3_exec(conn.handle(), "PRAGMA foreign_keys = ON;", nullptr, nullptr, nullptr);
+                throw;
+            }
+            if (m.rebuildsTables) executeOn(conn.handle(), "PRAGMA foreign_keys = ON;");
+            cout << "Применена миграция " << m.version << ": " << m.description << endl;
         }
     }
-    bool clearAllUsers() {
-        string sql = "DELETE FROM users;";
 
+    // Нарушения внешних ключей после пересоздания таблиц
+    static void checkForeignKeys(sqlite3* handle) {
         sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(handle, "PRAGMA foreign_key_check;", -1, &stmt, nullptr) != SQLITE_OK) {
+            throw DatabaseException("Ошибка проверки внешних ключей: " + string(sqlite3_errmsg(handle)));
+        }
+        string violations;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            violations += "\n  " + columnText(stmt, 0) + " rowid " + to_string(sqlite3_column_int64(stmt, 1)) +
+                " -> " + columnText(stmt, 2);
+        }
+        sqlite3_finalize(stmt);
+        if (!violations.empty()) {
+            throw DatabaseException("Нарушены внешние ключи:" + violations);
+        }
+    }
 
-        try {
-            int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-            if (rc != SQLITE_OK) {
-                throw DatabaseException("Ошибка подготовки запроса");
+    // Чтение строк результата в структуры (порядок столбцов - как в querySql)
+    static string columnText(sqlite3_stmt* stmt, int col) {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, col));
+        return text ? text : "";
+    }
+    static User readUser(sqlite3_stmt* stmt) {
+        User user;
+        user.id_user = sqlite3_column_int(stmt, 0);
+        user.username = columnText(stmt, 1);
+        user.password_hash = columnText(stmt, 2);
+        user.role = columnText(stmt, 3);
+        user.is_active = sqlite3_column_int(stmt, 4);
+        user.created_at = sqlite3_column_int64(stmt, 5);
+        return user;
+    }
+    static Secret readSecret(sqlite3_stmt* stmt) {
+        Secret s;
+        s.id_secrets = sqlite3_column_int(stmt, 0);
+        s.owner_id = sqlite3_column_int(stmt, 1);
+        s.secret_value = columnText(stmt, 2);
+        s.created_at = sqlite3_column_int64(stmt, 3);
+        s.expires_at = sqlite3_column_int64(stmt, 4);
+        s.secret_type = columnText(stmt, 5);
+        return s;
+    }
+    static AuditLog readAuditLog(sqlite3_stmt* stmt) {
+        AuditLog log;
+        log.id_audit_logs = sqlite3_column_int(stmt, 0);
+        log.user_id = sqlite3_column_int(stmt, 1);
+        log.action = columnText(stmt, 2);
+        log.object_type = columnText(stmt, 3);
+        log.object_id = sqlite3_column_int(stmt, 4);
+        log.created_at = sqlite3_column_int64(stmt, 5);
+        return log;
+    }
+
+    // limit = 0 - без ограничения
+    RowCursor<Secret> searchCursor(const string& pattern, const optional<int>& ownerId, size_t limit) {
+        sqlite3_int64 rowLimit = limit ? (sqlite3_int64)limit : -1;
+
+        if (utf8Length(pattern) < FTS_MIN_PATTERN) {
+            RowCursor<Secret> rows(pool.acquireReader(), Query::SearchSecrets, readSecret);
+            string p = "%" + pattern + "%";
+            sqlite3_bind_text(rows.statement(), 1, p.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(rows.statement(), 2, p.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int(rows.statement(), 3, ownerId ? 1 : 0);
+            sqlite3_bind_int(rows.statement(), 4, ownerId ? *ownerId : 0);
+            sqlite3_bind_int64(rows.statement(), 5, rowLimit);
+            return rows;
+        }
+
+        // Образец передается одной фразой FTS5: кавычки внутри удваиваются
+        string phrase = "\"";
+        for (char c : pattern) {
+            if (c == '"') phrase += '"';
+            phrase += c;
+        }
+        phrase += '"';
+
+        RowCursor<Secret> rows(pool.acquireReader(),
+            ownerId ? Query::FullTextSearchByOwner : Query::FullTextSearch, readSecret);
+        int param = 1;
+        sqlite3_bind_text(rows.statement(), param++, phrase.c_str(), -1, SQLITE_TRANSIENT);
+        if (ownerId) sqlite3_bind_int(rows.statement(), param++, *ownerId);
+        sqlite3_bind_int64(rows.statement(), param, rowLimit);
+        return rows;
+    }
+
+    template<typename T>
+    static vector<T> collect(RowCursor<T>&& rows) {
+        vector<T> items;
+        for (const T& item : rows) {
+            items.push_back(item);
+        }
+        return items;
+    }
+
+    // Общая реализация постраничной выборки. Параметры запросов:
+    // [ключ фильтра], [created_at, id курсора], limit. Запрашивается limit + 1
+    // строк, чтобы узнать, есть ли следующая страница
+    template<typename T, typename Reader, typename CursorOf>
+    Page<T> fetchPage(Query first, Query afterQuery, const optional<int>& key,
+        size_t limit, const optional<PageCursor>& after, Reader read, CursorOf cursorOf) {
+        auto conn = pool.acquireReader();
+        Statement stmt = conn.prepare(after ? afterQuery : first);
+
+        int param = 1;
+        if (key) {
+            sqlite3_bind_int(stmt, param++, *key);
+        }
+        if (after) {
+            sqlite3_bind_int64(stmt, param++, after->created_at);
+            sqlite3_bind_int(stmt, param++, after->id);
+        }
+        sqlite3_bind_int64(stmt, param, (sqlite3_int64)limit + 1);
+
+        return readPage<T>(stmt, limit, read, cursorOf);
+    }
+
+    // Чтение до limit строк подготовленного запроса; строка сверх limit
+    // означает, что есть следующая страница
+    template<typename T, typename Reader, typename CursorOf>
+    static Page<T> readPage(sqlite3_stmt* stmt, size_t limit, Reader read, CursorOf cursorOf) {
+        Page<T> page;
+        page.items.reserve(limit);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            if (page.items.size() == limit) {
+                page.hasMore = true;
+                break;
             }
+            page.items.push_back(read(stmt));
+        }
+        if (page.hasMore) {
+            page.next = cursorOf(page.items.back());
+        }
+        return page;
+    }
+
+    // Параметры запросов AuditLogsFiltered / AuditLogsByUserFiltered.
+    // Верхняя граница - меньшая из (to, 0) и курсора: id всегда больше нуля,
+    // поэтому (created_at, id) < (to, 0) равносильно created_at < to
+    static void bindAuditFilter(sqlite3_stmt* stmt, const AuditFilter& filter,
+        const optional<PageCursor>& after, sqlite3_int64 limit) {
+        PageCursor upper = filter.to ? PageCursor(*filter.to, 0) : PageCursor(INT64_MAX, INT32_MAX);
+        if (after && (after->created_at < upper.created_at ||
+            (after->created_at == upper.created_at && after->id < upper.id))) {
+            upper = *after;
+        }
 
-            rc = sqlite3_step(stmt);
-            bool success = (rc == SQLITE_DONE);
+        int param = 1;
+        if (filter.userId) {
+            sqlite3_bind_int(stmt, param++, *filter.userId);
+        }
+        sqlite3_bind_int64(stmt, param++, filter.from ? *filter.from : INT64_MIN);
+        sqlite3_bind_int64(stmt, param++, upper.created_at);
+        sqlite3_bind_int(stmt, param++, upper.id);
+        sqlite3_bind_text(stmt, param++, filter.action.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, param++, filter.action.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, param++, filter.objectType.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, param++, filter.objectType.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, param, limit);
+    }
 
-            if (success) {
-                cout << "Все пользователи удалены" << endl;
+    // Проверка планов всех запросов: полный просмотр таблицы или сортировка
+    // во временном B-дереве означают, что запросу не хватает индекса
+    void verifyQueryPlans() {
+        auto conn = pool.acquireWriter();
+        string problems;
+
+        for (int i = 0; i < (int)Query::Count; i++) {
+            Query id = (Query)i;
+            if (queryAllowsFullScan(id)) continue;
+
+            string sql = string("EXPLAIN QUERY PLAN ") + querySql(id);
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(conn.handle(), sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                string error = sqlite3_errmsg(conn.handle());
+                sqlite3_finalize(stmt);
+                throw DatabaseException("Ошибка подготовки запроса " + to_string(i) + ": " + error);
             }
 
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+                string detail = text ? text : "";
+                bool fullScan = detail.compare(0, 5, "SCAN ") == 0 &&
+                    detail.find(" USING ") == string::npos &&
+                    detail.find(" VIRTUAL TABLE ") == string::npos;
+                bool tempSort = detail.find("USE TEMP B-TREE") != string::npos;
+                if (fullScan || tempSort) {
+                    problems += "\n  [" + to_string(i) + "] " + querySql(id) + " -> " + detail;
+                }
+            }
             sqlite3_finalize(stmt);
-            return success;
-
         }
-        catch (...) {
-            if (stmt) sqlite3_finalize(stmt);
-            throw;
+
+        if (!problems.empty()) {
+            throw DatabaseException("Запросы без подходящего индекса:" + problems);
         }
     }
-    // Получение всех записей журнала аудита
-    vector<AuditLog> getAuditLogs() {
-        string sql =
-            "SELECT id_audit_logs, user_id, action, object_type, object_id, created_at "
-            "FROM audit_logs ORDER BY created_at DESC;";
 
-        vector<AuditLog> logs;
-        sqlite3_stmt* stmt = nullptr;
+    // Выполнение запроса на изменение; ошибка откатывает только эту операцию пакета
+    // Нарушения внешнего ключа и уникальности выдаются отдельными типами
+    static void stepWrite(ConnectionPool::Lease& conn, sqlite3_stmt* stmt) {
+        if (sqlite3_step(stmt) != SQLITE_DONE) throwWriteError(conn);
+    }
 
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-        if (rc != SQLITE_OK)
-            throw DatabaseException(sqlite3_errmsg(db));
+    // Изменение одной строки по ключу с RETURNING: первый столбец
+    // затронутой строки; nullopt - подходящей строки нет
+    static optional<int> stepReturningInt(ConnectionPool::Lease& conn, sqlite3_stmt* stmt) {
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_DONE) return nullopt;
+        if (rc != SQLITE_ROW) throwWriteError(conn);
+        int value = sqlite3_column_int(stmt, 0);
+        stepWrite(conn, stmt);
+        return value;
+    }
 
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            AuditLog log;
-            log.id_audit_logs = sqlite3_column_int(stmt, 0);
-            log.user_id = sqlite3_column_int(stmt, 1);
-            log.action = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-            log.object_type = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-            log.object_id = sqlite3_column_int(stmt, 4);
-            log.created_at = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-            logs.push_back(log);
+    [[noreturn]] static void throwWriteError(ConnectionPool::Lease& conn) {
+        string message = "Ошибка выполнения SQL: " + string(sqlite3_errmsg(conn.handle()));
+        switch (sqlite3_extended_errcode(conn.handle())) {
+        case SQLITE_CONSTRAINT_FOREIGNKEY:
+            throw ForeignKeyException(message);
+        case SQLITE_CONSTRAINT_UNIQUE:
+        case SQLITE_CONSTRAINT_PRIMARYKEY:
+            throw ConflictException(message);
+        default:
+            throw DatabaseException(message);
         }
+    }
 
-        sqlite3_finalize(stmt);
-        return logs;
+    // Автор записи аудита: 0 - неизвестен, пишется NULL (внешний ключ его не проверяет)
+    static void bindUserId(sqlite3_stmt* stmt, int index, int userId) {
+        if (userId > 0) sqlite3_bind_int(stmt, index, userId);
+        else sqlite3_bind_null(stmt, index);
     }
 
-private:
-    // Вспомогательные методы
+    // Вставка секрета: нарушение внешнего ключа owner_id - нет владельца
+    static void stepAddSecret(ConnectionPool::Lease& conn, sqlite3_stmt* stmt) {
+        try {
+            stepWrite(conn, stmt);
+        }
+        catch (const ForeignKeyException&) {
+            throw ForeignKeyException("Владелец секрета не существует");
+        }
+    }
 
     void executeSQL(const string& sql) {
+        auto conn = pool.acquireWriter();
+        executeOn(conn.handle(), sql.c_str());
+    }
+
+    static void executeOn(sqlite3* handle, const char* sql) {
         char* errMsg = nullptr;
-        int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg);
+        int rc = sqlite3_exec(handle, sql, nullptr, nullptr, &errMsg);
 
         if (rc != SQLITE_OK) {
             string error = errMsg ? errMsg : "Unknown error";
@@ -667,10 +2115,11 @@ private:
     }
 
     void executeSQLWithParam(const string& sql, const string& param) {
+        auto conn = pool.acquireWriter();
         sqlite3_stmt* stmt = nullptr;
 
         try {
-            int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+            int rc = sqlite3_prepare_v2(conn.handle(), sql.c_str(), -1, &stmt, nullptr);
             if (rc != SQLITE_OK) {
                 throw DatabaseException("Ошибка подготовки запроса");
             }
@@ -687,33 +2136,21 @@ private:
     }
 
     template<typename T>
-    T executeScalar(const string& sql) {
-        sqlite3_stmt* stmt = nullptr;
+    T executeScalar(Query id) {
+        auto conn = pool.acquireReader();
+        Statement stmt = conn.prepare(id);
 
-        try {
-            int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-            if (rc != SQLITE_OK) {
-                throw DatabaseException("Ошибка подготовки запроса");
+        T result{};
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            if constexpr (is_same_v<T, int>) {
+                result = sqlite3_column_int(stmt, 0);
             }
-
-            T result{};
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                if constexpr (is_same_v<T, int>) {
-                    result = sqlite3_column_int(stmt, 0);
-                }
-                else if constexpr (is_same_v<T, string>) {
-                    const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-                    result = text ? text : "";
-                }
+            else if constexpr (is_same_v<T, string>) {
+                const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+                result = text ? text : "";
             }
-
-            sqlite3_finalize(stmt);
-            return result;
-
-        }
-        catch (...) {
-            if (stmt) sqlite3_finalize(stmt);
-            throw;
         }
+
+        return result;
     }
 };
\ No newline at end of file
@@ -0,0 +1,221 @@
+﻿#pragma once
+#include "DataBase.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+
+// Колесо таймеров: slots ячеек по одной секунде. Срок в пределах горизонта
+// попадает в свою ячейку, уже наступивший - в текущую. Сроки дальше
+// горизонта не принимаются: их позже подгрузит запрос к индексу expires_at
+class TimerWheel {
+public:
+    explicit TimerWheel(size_t slots) : slots(slots ? slots : 1), current(0), currentTime(0) {}
+
+    // deadline, now - секунды Unix. false - срок за пределами горизонта
+    bool schedule(int id, long long deadline, long long now) {
+        if (currentTime == 0) currentTime = now;
+        long long offset = deadline - currentTime;
+        if (offset >= (long long)slots.size()) return false;
+        if (offset < 0) offset = 0;
+        slots[(current + (size_t)offset) % slots.size()].push_back(id);
+        return true;
+    }
+
+    // Сдвиг колеса до now; возвращает id из пройденных ячеек
+    vector<int> advance(long long now) {
+        vector<int> due;
+        if (currentTime == 0) currentTime = now;
+        while (currentTime <= now) {
+            auto& slot = slots[current];
+            due.insert(due.end(), slot.begin(), slot.end());
+            slot.clear();
+            current = (current + 1) % slots.size();
+            currentTime++;
+            // После долгого простоя не перебираем каждую пропущенную секунду
+            if (now - currentTime >= (long long)slots.size()) {
+                for (auto& rest : slots) {
+                    due.insert(due.end(), rest.begin(), rest.end());
+                    rest.clear();
+                }
+                currentTime = now + 1;
+            }
+        }
+        return due;
+    }
+
+    chrono::seconds horizon() const { return chrono::seconds(slots.size()); }
+
+private:
+    vector<vector<int>> slots;
+    size_t current;
+    long long currentTime;      // время (секунды Unix) текущей ячейки
+};
+
+struct ExpirySweeperConfig {
+    size_t wheelSlots = 3600;                               // горизонт колеса, секунд
+    chrono::seconds refillInterval = chrono::minutes(10);   // подгрузка сроков из индекса
+    size_t maxTracked = 10000;                              // сроков в колесе, не больше
+    size_t batchSize = 100;                                 // удалений в одной транзакции
+    chrono::milliseconds batchPause = chrono::milliseconds(20);
+};
+
+// Фоновое удаление секретов с истекшим сроком действия. Ближайшие сроки
+// держатся в колесе таймеров; раз в refillInterval оно пополняется запросом
+// по частичному индексу idx_secrets_expires. Удаление идет небольшими
+// пакетами с паузой, чтобы не занимать очередь записи надолго
+class ExpirySweeper {
+public:
+    struct Stats {
+        size_t tracked;
+        uint64_t deleted;
+        uint64_t batches;
+        uint64_t refills;
+    };
+
+    explicit ExpirySweeper(DataBase& db, const ExpirySweeperConfig& config = ExpirySweeperConfig())
+        : db(db), config(config), running(false), stopping(false), wheel(config.wheelSlots),
+        deleted(0), batches(0), refills(0) {}
+
+    ~ExpirySweeper() { stop(); }
+
+    void start() {
+        if (running.exchange(true)) return;
+        stopping = false;
+        worker = thread(&ExpirySweeper::run, this);
+    }
+
+    void stop() {
+        if (!running) return;
+        {
+            lock_guard<mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) worker.join();
+        running = false;
+    }
+
+    // Новый или измененный срок секрета (микросекунды Unix). Сроки дальше
+    // горизонта колеса подхватит следующая подгрузка из базы
+    void track(int secretId, int64_t deadline) {
+        lock_guard<mutex> lock(stateMutex);
+        if (tracked.size() >= config.maxTracked || tracked.count(secretId)) return;
+        if (wheel.schedule(secretId, wheelSecond(deadline), (long long)time(nullptr))) {
+            tracked.insert(secretId);
+        }
+    }
+
+    // Вызывается из потока удаления с id удаленных секретов
+    // (например, для сброса кэша); задается до start()
+    void onDeleted(function<void(const vector<int>&)> callback) {
+        deletedCallback = move(callback);
+    }
+
+    Stats stats() {
+        lock_guard<mutex> lock(stateMutex);
+        return { tracked.size(), deleted.load(), batches.load(), refills.load() };
+    }
+
+private:
+    DataBase& db;
+    ExpirySweeperConfig config;
+    thread worker;
+    atomic<bool> running;
+
+    mutex stateMutex;
+    condition_variable wake;
+    bool stopping;
+    TimerWheel wheel;
+    unordered_set<int> tracked;
+    function<void(const vector<int>&)> deletedCallback;
+
+    atomic<uint64_t> deleted;
+    atomic<uint64_t> batches;
+    atomic<uint64_t> refills;
+
+    // Ячейка колеса для срока: секунда, округленная вверх, чтобы
+    // секрет не попал в удаление раньше своего срока
+    static long long wheelSecond(int64_t deadline) {
+        return (long long)((deadline + timestamp::MICROS_PER_SECOND - 1) / timestamp::MICROS_PER_SECOND);
+    }
+
+    void run() {
+        auto nextRefill = chrono::steady_clock::now();
+        while (true) {
+            auto now = chrono::steady_clock::now();
+            if (now >= nextRefill) {
+                // Колесо заполнено до предела - в базе могут остаться истекшие
+                // секреты, следующая подгрузка сразу после этого прохода
+                bool saturated = refill();
+                nextRefill = saturated ? now : now + config.refillInterval;
+            }
+
+            vector<int> due;
+            {
+                lock_guard<mutex> lock(stateMutex);
+                due = wheel.advance((long long)time(nullptr));
+                for (int id : due) tracked.erase(id);
+            }
+            if (!sweep(due)) return;
+
+            unique_lock<mutex> lock(stateMutex);
+            if (stopping) return;
+            wake.wait_for(lock, chrono::seconds(1), [this] { return stopping; });
+            if (stopping) return;
+        }
+    }
+
+    // true - загружено maxTracked сроков и среди них были новые: в базе могут быть еще
+    bool refill() {
+        try {
+            auto expiring = db.getExpiringSecrets(wheel.horizon(), config.maxTracked);
+            long long now = (long long)time(nullptr);
+            size_t added = 0;
+            lock_guard<mutex> lock(stateMutex);
+            for (auto& entry : expiring) {
+                if (tracked.size() >= config.maxTracked) break;
+                if (tracked.count(entry.first)) continue;
+                if (wheel.schedule(entry.first, wheelSecond(entry.second), now)) {
+                    tracked.insert(entry.first);
+                    added++;
+                }
+            }
+            refills++;
+            return expiring.size() >= config.maxTracked && added > 0;
+        }
+        catch (const exception& e) {
+            cerr << "Ошибка чтения сроков действия секретов: " << e.what() << endl;
+            return false;
+        }
+    }
+
+    // false - получен сигнал остановки
+    bool sweep(const vector<int>& due) {
+        for (size_t start = 0; start < due.size(); start += config.batchSize) {
+            vector<int> batch(due.begin() + start,
+                due.begin() + min(due.size(), start + config.batchSize));
+            try {
+                auto removed = db.deleteExpiredSecrets(batch);
+                deleted += removed.size();
+                batches++;
+                if (deletedCallback && !removed.empty()) deletedCallback(removed);
+            }
+            catch (const exception& e) {
+                cerr << "Ошибка удаления истекших секретов: " << e.what() << endl;
+            }
+
+            if (start + config.batchSize < due.size()) {
+                unique_lock<mutex> lock(stateMutex);
+                if (wake.wait_for(lock, config.batchPause, [this] { return stopping; })) return false;
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,228 @@
+﻿#pragma once
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSON_WRITER_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+using namespace std;
+
+// Потоковая запись JSON в строку без построения дерева: значения
+// записываются сразу в буфер по мере вызовов. По умолчанию - компактный
+// вывод, pretty - с отступами по 4 пробела, как json::dump(4).
+// Строки экранируются по 16 байт за шаг (SSE2); байты, не образующие
+// корректный UTF-8, заменяются на U+FFFD
+class JsonWriter {
+public:
+    explicit JsonWriter(bool pretty = false) : pretty(pretty), afterKey(false) {}
+
+    JsonWriter& beginObject() { return open('{'); }
+    JsonWriter& endObject() { return close('}'); }
+    JsonWriter& beginArray() { return open('['); }
+    JsonWriter& endArray() { return close(']'); }
+
+    JsonWriter& key(string_view name) {
+        separate();
+        appendString(out, name);
+        out += pretty ? ": " : ":";
+        afterKey = true;
+        return *this;
+    }
+
+    JsonWriter& value(string_view text) {
+        separate();
+        appendString(out, text);
+        return *this;
+    }
+    JsonWriter& value(const char* text) { return value(string_view(text)); }
+    JsonWriter& value(const string& text) { return value(string_view(text)); }
+
+    JsonWriter& value(bool flag) {
+        separate();
+        out += flag ? "true" : "false";
+        return *this;
+    }
+
+    template<typename T, enable_if_t<is_integral_v<T> && !is_same_v<T, bool>, int> = 0>
+    JsonWriter& value(T number) {
+        separate();
+        char buffer[24];
+        auto result = to_chars(buffer, buffer + sizeof(buffer), number);
+        out.append(buffer, result.ptr);
+        return *this;
+    }
+
+    JsonWriter& null() {
+        separate();
+        out += "null";
+        return *this;
+    }
+
+    template<typename T>
+    JsonWriter& field(string_view name, const T& v) {
+        key(name);
+        return value(v);
+    }
+
+    // Накопленный текст; clear() очищает буфер, не сбрасывая вложенность,
+    // чтобы продолжить запись после отправки очередной части
+    string& buffer() { return out; }
+    void clear() { out.clear(); }
+    string release() { return move(out); }
+
+    // Строка JSON в кавычках с экранированием
+    static void appendString(string& out, string_view text) {
+        const char* p = text.data();
+        const char* end = p + text.size();
+        out += '"';
+#ifdef JSON_WRITER_SSE2
+        const __m128i space = _mm_set1_epi8(0x20);
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        while (end - p >= 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            // Знаковое сравнение отмечает и управляющие символы, и байты >= 0x80
+            __m128i special = _mm_or_si128(_mm_cmplt_epi8(chunk, space),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+            unsigned mask = (unsigned)_mm_movemask_epi8(special);
+            if (mask == 0) {
+                out.append(p, 16);
+                p += 16;
+                continue;
+            }
+            unsigned plain = lowestBit(mask);
+            out.append(p, plain);
+            p = appendSpecial(out, p + plain, end);
+        }
+#endif
+        while (p < end) {
+            const char* start = p;
+            while (p < end && isPlain((unsigned char)*p)) p++;
+            out.append(start, p - start);
+            if (p < end) p = appendSpecial(out, p, end);
+        }
+        out += '"';
+    }
+
+private:
+    string out;
+    bool pretty;
+    bool afterKey;
+    vector<bool> firstElement;     // для каждого открытого контейнера: элементов еще не было
+
+    JsonWriter& open(char bracket) {
+        separate();
+        out += bracket;
+        firstElement.push_back(true);
+        return *this;
+    }
+
+    JsonWriter& close(char bracket) {
+        bool wasEmpty = firstElement.back();
+        firstElement.pop_back();
+        if (pretty && !wasEmpty) newline();
+        out += bracket;
+        return *this;
+    }
+
+    // Запятая и перевод строки перед элементом контейнера; после ключа - ничего
+    void separate() {
+        if (afterKey) {
+            afterKey = false;
+            return;
+        }
+        if (firstElement.empty()) return;
+        if (!firstElement.back()) out += ',';
+        firstElement.back() = false;
+        if (pretty) newline();
+    }
+
+    void newline() {
+        out += '\n';
+        out.append(firstElement.size() * 4, ' ');
+    }
+
+    static bool isPlain(unsigned char c) {
+        return c >= 0x20 && c < 0x80 && c != '"' && c != '\\';
+    }
+
+#ifdef JSON_WRITER_SSE2
+    static unsigned lowestBit(unsigned mask) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (unsigned)index;
+#else
+        return (unsigned)__builtin_ctz(mask);
+#endif
+    }
+#endif
+
+    // Один символ, требующий обработки: экранирование ASCII или проверка
+    // последовательности UTF-8. Возвращает позицию следующего символа
+    static const char* appendSpecial(string& out, const char* p, const char* end) {
+        static const char digits[] = "0123456789abcdef";
+        unsigned char c = (unsigned char)*p;
+        if (c < 0x80) {
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                out += "\\u00";
+                out += digits[c >> 4];
+                out += digits[c & 0x0F];
+            }
+            return p + 1;
+        }
+
+        size_t length = utf8SequenceLength(p, end);
+        if (length == 0) {
+            out += "\xEF\xBF\xBD";
+            return p + 1;
+        }
+        out.append(p, length);
+        return p + length;
+    }
+
+    // Длина корректной последовательности UTF-8 (без избыточных форм
+    // и суррогатов); 0 - последовательность некорректна
+    static size_t utf8SequenceLength(const char* p, const char* end) {
+        const unsigned char* s = reinterpret_cast<const unsigned char*>(p);
+        size_t available = (size_t)(end - p);
+        size_t length;
+        unsigned char low = 0x80, high = 0xBF;      // допустимый диапазон второго байта
+        if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+            length = 2;
+        }
+        else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+            length = 3;
+            if (s[0] == 0xE0) low = 0xA0;
+            if (s[0] == 0xED) high = 0x9F;
+        }
+        else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+            length = 4;
+            if (s[0] == 0xF0) low = 0x90;
+            if (s[0] == 0xF4) high = 0x8F;
+        }
+        else {
+            return 0;
+        }
+        if (available < length || s[1] < low || s[1] > high) return 0;
+        for (size_t i = 2; i < length; i++) {
+            if ((s[i] & 0xC0) != 0x80) return 0;
+        }
+        return length;
+    }
+};
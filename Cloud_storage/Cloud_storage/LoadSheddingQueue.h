@@ -0,0 +1,214 @@
+﻿#pragma once
+#include "httplib.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+struct ServerConfig {
+    size_t workers = 0;                         // 0 - CPPHTTPLIB_THREAD_POOL_COUNT
+    size_t maxQueued = 64;                      // соединений, ожидающих свободного потока
+    size_t shedQueue = 64;                      // соединений, ожидающих ответа 503
+    size_t keepAliveMaxCount = 100;             // запросов на одно соединение
+    chrono::seconds keepAliveTimeout{ 5 };
+    chrono::seconds readTimeout{ 5 };
+    chrono::seconds writeTimeout{ 5 };
+    chrono::seconds retryAfter{ 1 };            // Retry-After в ответе 503
+};
+
+// Очередь соединений httplib вместо ThreadPool: соединение обслуживается
+// одним потоком от первого до последнего запроса keep-alive, поэтому число
+// потоков - это число одновременно обслуживаемых клиентов. Ожидание потока
+// ограничено maxQueued; соединения сверх него уходят в отдельный поток,
+// в котором SheddingServer отвечает на них готовым 503 (isShedding() -
+// признак этого потока). Переполнена и эта очередь - соединение
+// закрывается без ответа, как в ThreadPool httplib
+class LoadSheddingQueue : public httplib::TaskQueue {
+public:
+    struct Stats {
+        size_t workers;
+        size_t busy;
+        size_t queueDepth;
+        uint64_t accepted;
+        uint64_t shed;
+        uint64_t dropped;
+    };
+
+    LoadSheddingQueue(size_t workers, size_t maxQueued, size_t shedQueue)
+        : maxQueued(maxQueued), maxShed(shedQueue), idle(0), stopping(false),
+        accepted(0), shed(0), dropped(0) {
+        for (size_t i = 0; i < max<size_t>(1, workers); i++) {
+            threads.emplace_back(&LoadSheddingQueue::runWorker, this);
+        }
+        shedder = thread(&LoadSheddingQueue::runShedder, this);
+    }
+
+    ~LoadSheddingQueue() override {
+        shutdown();
+    }
+
+    bool enqueue(function<void()> fn) override {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            // Свободные потоки заберут соединения сразу - ожиданием это не считается
+            if (jobs.size() < maxQueued + idle) {
+                jobs.push_back(move(fn));
+                accepted++;
+                wake.notify_one();
+                return true;
+            }
+            if (shedJobs.size() < maxShed) {
+                shedJobs.push_back(move(fn));
+                shed++;
+                shedWake.notify_one();
+                return true;
+            }
+            dropped++;
+        }
+        return false;
+    }
+
+    // Оставшиеся в очередях соединения обслуживаются до выхода
+    void shutdown() override {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            if (stopping) return;
+            stopping = true;
+        }
+        wake.notify_all();
+        shedWake.notify_all();
+        for (auto& worker : threads) worker.join();
+        shedder.join();
+    }
+
+    // true - текущий поток отвечает на соединения сверх очереди
+    static bool isShedding() {
+        return sheddingThread();
+    }
+
+    Stats stats() {
+        lock_guard<mutex> lock(queueMutex);
+        return { threads.size(), threads.size() - idle, jobs.size(), accepted, shed, dropped };
+    }
+
+private:
+    size_t maxQueued;
+    size_t maxShed;
+    vector<thread> threads;
+    thread shedder;
+    mutex queueMutex;
+    condition_variable wake;
+    condition_variable shedWake;
+    deque<function<void()>> jobs;
+    deque<function<void()>> shedJobs;
+    size_t idle;                    // потоков, ждущих соединения
+    bool stopping;
+    uint64_t accepted;
+    uint64_t shed;
+    uint64_t dropped;
+
+    static bool& sheddingThread() {
+        thread_local bool shedding = false;
+        return shedding;
+    }
+
+    void runWorker() {
+        process(jobs, wake, true);
+    }
+
+    void runShedder() {
+        sheddingThread() = true;
+        process(shedJobs, shedWake, false);
+    }
+
+    void process(deque<function<void()>>& queue, condition_variable& ready, bool countIdle) {
+        while (true) {
+            function<void()> job;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                if (countIdle) idle++;
+                ready.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (countIdle) idle--;
+                if (queue.empty()) return;
+                job = move(queue.front());
+                queue.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+// Сервер httplib, который в потоке сброса нагрузки (LoadSheddingQueue::isShedding())
+// не разбирает запрос и не ждет keep-alive: готовый 503 с Retry-After и
+// Connection: close пишется прямо в сокет, и соединение закрывается, поэтому
+// медленный клиент не задерживает ответы остальным. Остальные соединения
+// обслуживаются как в httplib::Server
+class SheddingServer : public httplib::Server {
+public:
+    SheddingServer() {
+        setRetryAfter(chrono::seconds(1));
+    }
+
+    void setRetryAfter(chrono::seconds retryAfter) {
+        // u8: тело всегда в UTF-8, в какой бы кодировке ни собирались строки
+        static const string body = u8"{\"error\":\"Сервер перегружен, повторите запрос позже\"}";
+        shedResponse = "HTTP/1.1 503 Service Unavailable\r\n"
+            "Content-Type: application/json\r\n"
+            "Content-Length: " + to_string(body.size()) + "\r\n"
+            "Retry-After: " + to_string(retryAfter.count()) + "\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Connection: close\r\n\r\n" + body;
+    }
+
+private:
+    // Сколько вычитывать запрос перед закрытием: закрытие сокета с непрочитанными
+    // данными отправляет RST, и клиент может не успеть прочитать ответ
+    static constexpr long SHED_DRAIN_MICROS = 100000;
+
+    string shedResponse;
+
+    bool process_and_close_socket(socket_t sock) override {
+        if (LoadSheddingQueue::isShedding()) {
+            reject(sock);
+            return true;
+        }
+
+        // То же, что httplib::Server::process_and_close_socket (закрыт в базовом классе)
+        string remoteAddr, localAddr;
+        int remotePort = 0, localPort = 0;
+        httplib::detail::get_remote_ip_and_port(sock, remoteAddr, remotePort);
+        httplib::detail::get_local_ip_and_port(sock, localAddr, localPort);
+        bool ret = httplib::detail::process_server_socket(
+            svr_sock_, sock, keep_alive_max_count_, keep_alive_timeout_sec_,
+            read_timeout_sec_, read_timeout_usec_, write_timeout_sec_, write_timeout_usec_,
+            [&](httplib::Stream& strm, bool closeConnection, bool& connectionClosed) {
+                return process_request(strm, remoteAddr, remotePort, localAddr, localPort,
+                    closeConnection, connectionClosed, nullptr);
+            });
+        httplib::detail::shutdown_socket(sock);
+        httplib::detail::close_socket(sock);
+        return ret;
+    }
+
+    void reject(socket_t sock) {
+        if (httplib::detail::select_write(sock, write_timeout_sec_, write_timeout_usec_) > 0) {
+            httplib::detail::send_socket(sock, shedResponse.data(), shedResponse.size(), CPPHTTPLIB_SEND_FLAGS);
+        }
+        auto deadline = chrono::steady_clock::now() + chrono::microseconds(SHED_DRAIN_MICROS);
+        char buffer[4096];
+        while (true) {
+            auto left = chrono::duration_cast<chrono::microseconds>(deadline - chrono::steady_clock::now()).count();
+            if (left <= 0 || httplib::detail::select_read(sock, 0, (time_t)left) <= 0) break;
+            if (httplib::detail::read_socket(sock, buffer, sizeof(buffer), 0) <= 0) break;
+        }
+        httplib::detail::shutdown_socket(sock);
+        httplib::detail::close_socket(sock);
+    }
+};
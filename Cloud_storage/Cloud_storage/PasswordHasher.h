@@ -0,0 +1,390 @@
+﻿#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// SHA-256 (FIPS 180-4)
+class Sha256 {
+public:
+    static constexpr size_t DIGEST_SIZE = 32;
+    static constexpr size_t BLOCK_SIZE = 64;
+    using Digest = array<uint8_t, DIGEST_SIZE>;
+
+    Sha256() { reset(); }
+
+    void reset() {
+        static const uint32_t init[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        memcpy(state, init, sizeof(state));
+        length = 0;
+        buffered = 0;
+    }
+
+    void update(const uint8_t* data, size_t size) {
+        length += size;
+        if (buffered) {
+            size_t take = min(size, BLOCK_SIZE - buffered);
+            memcpy(buffer + buffered, data, take);
+            buffered += take;
+            data += take;
+            size -= take;
+            if (buffered < BLOCK_SIZE) return;
+            compress(buffer);
+            buffered = 0;
+        }
+        for (; size >= BLOCK_SIZE; data += BLOCK_SIZE, size -= BLOCK_SIZE) {
+            compress(data);
+        }
+        memcpy(buffer, data, size);
+        buffered = size;
+    }
+
+    void update(const string& data) {
+        update((const uint8_t*)data.data(), data.size());
+    }
+
+    Digest finish() {
+        uint64_t bits = length * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (buffered != BLOCK_SIZE - 8) update(&pad, 1);
+        uint8_t tail[8];
+        for (int i = 0; i < 8; i++) tail[i] = (uint8_t)(bits >> (56 - 8 * i));
+        update(tail, 8);
+
+        Digest digest;
+        for (int i = 0; i < 8; i++) {
+            digest[4 * i] = (uint8_t)(state[i] >> 24);
+            digest[4 * i + 1] = (uint8_t)(state[i] >> 16);
+            digest[4 * i + 2] = (uint8_t)(state[i] >> 8);
+            digest[4 * i + 3] = (uint8_t)state[i];
+        }
+        return digest;
+    }
+
+private:
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t buffer[BLOCK_SIZE];
+    size_t buffered;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const uint8_t* block) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+                ((uint32_t)block[4 * i + 2] << 8) | (uint32_t)block[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+};
+
+// HMAC-SHA256. Состояния после ipad/opad вычисляются один раз на ключ,
+// поэтому каждая итерация PBKDF2 стоит два сжатия блока, а не четыре
+class HmacSha256 {
+public:
+    explicit HmacSha256(const string& key) {
+        uint8_t block[Sha256::BLOCK_SIZE] = {};
+        if (key.size() > Sha256::BLOCK_SIZE) {
+            Sha256 h;
+            h.update(key);
+            auto digest = h.finish();
+            memcpy(block, digest.data(), digest.size());
+        }
+        else {
+            memcpy(block, key.data(), key.size());
+        }
+
+        uint8_t pad[Sha256::BLOCK_SIZE];
+        for (size_t i = 0; i < Sha256::BLOCK_SIZE; i++) pad[i] = block[i] ^ 0x36;
+        inner.update(pad, sizeof(pad));
+        for (size_t i = 0; i < Sha256::BLOCK_SIZE; i++) pad[i] = block[i] ^ 0x5c;
+        outer.update(pad, sizeof(pad));
+    }
+
+    Sha256::Digest compute(const uint8_t* data, size_t size) const {
+        Sha256 h = inner;
+        h.update(data, size);
+        auto digest = h.finish();
+        Sha256 o = outer;
+        o.update(digest.data(), digest.size());
+        return o.finish();
+    }
+
+private:
+    Sha256 inner;
+    Sha256 outer;
+};
+
+// PBKDF2-HMAC-SHA256 (RFC 8018) с длиной результата в один блок
+inline Sha256::Digest pbkdf2Sha256(const string& password, const string& salt, uint32_t iterations) {
+    HmacSha256 prf(password);
+    string first = salt;
+    first.append("\x00\x00\x00\x01", 4);
+    auto u = prf.compute((const uint8_t*)first.data(), first.size());
+    auto result = u;
+    for (uint32_t i = 1; i < iterations; i++) {
+        u = prf.compute(u.data(), u.size());
+        for (size_t j = 0; j < result.size(); j++) result[j] ^= u[j];
+    }
+    return result;
+}
+
+// Очередь хеширования переполнена - запрос нужно повторить позже
+class HasherBusyException : public runtime_error {
+public:
+    explicit HasherBusyException(const string& msg) : runtime_error(msg) {}
+};
+
+struct PasswordHasherConfig {
+    uint32_t iterations = 100000;    // стоимость PBKDF2
+    size_t saltBytes = 16;
+    size_t threads = 0;              // 0 - четверть ядер, но не меньше одного
+    size_t maxQueue = 4;             // задач, ожидающих свободного потока
+};
+
+// Хеширование паролей в отдельном пуле потоков. Число одновременно
+// вычисляемых хешей ограничено числом потоков пула, очередь ожидания
+// ограничена maxQueue: при переполнении задача отклоняется сразу.
+// Поток HTTP-сервера ждет результата, поэтому threads + maxQueue должно
+// быть заметно меньше числа потоков сервера - остальные обслуживают чтение
+class PasswordHasher {
+public:
+    struct Stats {
+        size_t threads;
+        size_t queueDepth;
+        uint64_t completed;
+        uint64_t rejected;
+        uint32_t iterations;
+    };
+
+    // Результат проверки пароля; rehash - хеш устарел и его стоит пересохранить
+    struct Verification {
+        bool valid;
+        string rehash;
+    };
+
+    explicit PasswordHasher(const PasswordHasherConfig& config = PasswordHasherConfig())
+        : config(config), stopping(false), completed(0), rejected(0) {
+        if (this->config.iterations == 0) this->config.iterations = 1;
+        // Соль и хеш не важны: проверка по нему всегда неуспешна, но стоит столько же
+        dummyHash = string(PREFIX) + to_string(this->config.iterations) + "$" +
+            string(max<size_t>(1, this->config.saltBytes) * 2, '0') + "$" + string(64, '0');
+        size_t count = config.threads ? config.threads : max(1u, thread::hardware_concurrency() / 4);
+        for (size_t i = 0; i < count; i++) {
+            workers.emplace_back(&PasswordHasher::run, this);
+        }
+    }
+
+    ~PasswordHasher() {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    PasswordHasher(const PasswordHasher&) = delete;
+    PasswordHasher& operator=(const PasswordHasher&) = delete;
+
+    // Хеш нового пароля в формате pbkdf2-sha256$<итерации>$<соль>$<хеш>
+    string hash(const string& password) {
+        return submit([this, password] { return hashNow(password); }).get();
+    }
+
+    // Проверка пароля по сохраненному хешу. Поддерживаются и старые
+    // хеши std::hash без соли: при успешной проверке возвращается новый хеш
+    Verification verify(const string& password, const string& stored) {
+        return submit([this, password, stored] { return verifyNow(password, stored); }).get();
+    }
+
+    // Проверка для несуществующего или отключенного пользователя: та же работа
+    // PBKDF2 с текущей стоимостью, что и для настоящего хеша, чтобы по времени
+    // ответа нельзя было узнать, есть ли такой логин. Результат - false
+    bool verifyAbsent(const string& password) {
+        return submit([this, password] { return verifyNow(password, dummyHash).valid; }).get();
+    }
+
+    static bool isLegacyHash(const string& stored) {
+        return stored.compare(0, PREFIX_SIZE, PREFIX) != 0;
+    }
+
+    Stats stats() {
+        size_t depth;
+        {
+            lock_guard<mutex> lock(queueMutex);
+            depth = tasks.size();
+        }
+        return { workers.size(), depth, completed.load(), rejected.load(), config.iterations };
+    }
+
+private:
+    static constexpr const char* PREFIX = "pbkdf2-sha256$";
+    static constexpr size_t PREFIX_SIZE = 14;
+
+    PasswordHasherConfig config;
+    string dummyHash;               // для verifyAbsent
+    vector<thread> workers;
+    mutex queueMutex;
+    condition_variable wake;
+    deque<function<void()>> tasks;
+    bool stopping;
+    mutex randomMutex;
+    random_device random;
+    atomic<uint64_t> completed;
+    atomic<uint64_t> rejected;
+
+    template<typename F>
+    future<decltype(declval<F>()())> submit(F work) {
+        using Result = decltype(work());
+        auto task = make_shared<packaged_task<Result()>>(move(work));
+        future<Result> result = task->get_future();
+        {
+            lock_guard<mutex> lock(queueMutex);
+            if (tasks.size() >= config.maxQueue) {
+                rejected++;
+                throw HasherBusyException("Сервер перегружен запросами входа, повторите позже");
+            }
+            tasks.emplace_back([task] { (*task)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    void run() {
+        while (true) {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+            completed++;
+        }
+    }
+
+    string hashNow(const string& password) {
+        string salt;
+        {
+            lock_guard<mutex> lock(randomMutex);
+            while (salt.size() < config.saltBytes) {
+                uint32_t value = random();
+                for (int b = 0; b < 4 && salt.size() < config.saltBytes; b++, value >>= 8) {
+                    salt += (char)(value & 0xFF);
+                }
+            }
+        }
+        auto digest = pbkdf2Sha256(password, salt, config.iterations);
+        return string(PREFIX) + to_string(config.iterations) + "$" + toHex(salt) + "$" +
+            toHex(string((const char*)digest.data(), digest.size()));
+    }
+
+    Verification verifyNow(const string& password, const string& stored) {
+        if (isLegacyHash(stored)) {
+            bool valid = constantTimeEquals(to_string(std::hash<string>()(password)), stored);
+            return { valid, valid ? hashNow(password) : "" };
+        }
+
+        size_t iterEnd = stored.find('$', PREFIX_SIZE);
+        size_t saltEnd = iterEnd == string::npos ? string::npos : stored.find('$', iterEnd + 1);
+        if (saltEnd == string::npos) return { false, "" };
+
+        string iterText = stored.substr(PREFIX_SIZE, iterEnd - PREFIX_SIZE);
+        if (iterText.empty() || iterText.size() > 9 ||
+            iterText.find_first_not_of("0123456789") != string::npos) {
+            return { false, "" };
+        }
+        uint32_t iterations = (uint32_t)stoul(iterText);
+        string salt;
+        if (iterations == 0 || !fromHex(stored.substr(iterEnd + 1, saltEnd - iterEnd - 1), salt)) {
+            return { false, "" };
+        }
+
+        auto digest = pbkdf2Sha256(password, salt, iterations);
+        bool valid = constantTimeEquals(toHex(string((const char*)digest.data(), digest.size())),
+            stored.substr(saltEnd + 1));
+        bool outdated = iterations != config.iterations;
+        return { valid, valid && outdated ? hashNow(password) : "" };
+    }
+
+    static bool constantTimeEquals(const string& a, const string& b) {
+        if (a.size() != b.size()) return false;
+        unsigned char diff = 0;
+        for (size_t i = 0; i < a.size(); i++) diff |= (unsigned char)(a[i] ^ b[i]);
+        return diff == 0;
+    }
+
+    static string toHex(const string& raw) {
+        static const char digits[] = "0123456789abcdef";
+        string out;
+        out.reserve(raw.size() * 2);
+        for (unsigned char c : raw) {
+            out += digits[c >> 4];
+            out += digits[c & 0x0F];
+        }
+        return out;
+    }
+
+    static bool fromHex(const string& hex, string& raw) {
+        auto value = [](char c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            return -1;
+        };
+        if (hex.empty() || hex.size() % 2 != 0) return false;
+        raw.clear();
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            int hi = value(hex[i]), lo = value(hex[i + 1]);
+            if (hi < 0 || lo < 0) return false;
+            raw += (char)(hi * 16 + lo);
+        }
+        return true;
+    }
+};
@@ -0,0 +1,267 @@
+﻿#pragma once
+#include "json.hpp"
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Тело запроса больше допустимого размера
+class PayloadTooLargeException : public invalid_argument {
+public:
+    PayloadTooLargeException(const string& message) : invalid_argument(message) {}
+};
+
+// Скалярное значение поля из тела запроса
+struct RequestValue {
+    enum class Type { Null, Boolean, Integer, Float, String };
+
+    Type type = Type::Null;
+    bool boolean = false;
+    long long integer = 0;
+    string text;
+
+    // false - значение другого типа или вне диапазона int
+    bool toInt(int& out) const {
+        if (type != Type::Integer || integer < INT_MIN || integer > INT_MAX) return false;
+        out = (int)integer;
+        return true;
+    }
+    bool toBool(bool& out) const {
+        if (type != Type::Boolean) return false;
+        out = boolean;
+        return true;
+    }
+    // Строка забирается без копирования
+    bool take(string& out) {
+        if (type != Type::String) return false;
+        out = move(text);
+        return true;
+    }
+};
+
+// Допустимое поле записи: assign переносит значение в структуру и возвращает
+// false при неверном типе; nullptr - поле допускается, но не используется
+template<typename T>
+struct RequestField {
+    const char* name;
+    bool required;
+    bool (*assign)(T& target, RequestValue& value);
+};
+
+// Запись из массива: значение или текст ошибки именно этой записи
+template<typename T>
+struct ParsedItem {
+    T value;
+    string error;
+};
+
+// SAX-обработчик nlohmann::json: поля плоских объектов сразу переносятся
+// в структуры T, дерево документа не строится. Разбор прерывается на
+// первом неизвестном поле, вложенном значении или лишней записи массива.
+// Формы тела: один объект; для массива записей - [ {...}, ... ] или
+// { "<itemsKey>": [ {...}, ... ] }. Учетные данные (username, password)
+// допускаются на верхнем уровне любого тела
+template<typename T>
+class RecordSax : public nlohmann::json_sax<nlohmann::json> {
+public:
+    RecordSax(const vector<RequestField<T>>& fields, const char* itemsKey, size_t maxItems)
+        : fields(fields), itemsKey(itemsKey), maxItems(maxItems), field(nullptr), present(0) {}
+
+    vector<ParsedItem<T>> items;
+    std::string error;   // имя string внутри класса занято методом SAX-интерфейса
+
+    bool null() override {
+        return scalar(RequestValue());
+    }
+    bool boolean(bool value) override {
+        RequestValue v;
+        v.type = RequestValue::Type::Boolean;
+        v.boolean = value;
+        return scalar(move(v));
+    }
+    bool number_integer(number_integer_t value) override {
+        RequestValue v;
+        v.type = RequestValue::Type::Integer;
+        v.integer = value;
+        return scalar(move(v));
+    }
+    bool number_unsigned(number_unsigned_t value) override {
+        RequestValue v;
+        v.type = value > (number_unsigned_t)LLONG_MAX ? RequestValue::Type::Float : RequestValue::Type::Integer;
+        v.integer = (long long)value;
+        return scalar(move(v));
+    }
+    bool number_float(number_float_t, const string_t&) override {
+        RequestValue v;
+        v.type = RequestValue::Type::Float;
+        return scalar(move(v));
+    }
+    bool string(string_t& value) override {
+        RequestValue v;
+        v.type = RequestValue::Type::String;
+        v.text = move(value);
+        return scalar(move(v));
+    }
+    bool binary(binary_t&) override {
+        return fail("Двоичные значения не поддерживаются");
+    }
+
+    bool start_object(size_t) override {
+        if (stack.empty()) {
+            if (itemsKey) {
+                stack.push_back(Level::Wrapper);
+            }
+            else {
+                beginRecord();
+            }
+            return true;
+        }
+        if (stack.back() == Level::Items) {
+            if (items.size() >= maxItems) return fail("Не более " + to_string(maxItems) + " записей за запрос");
+            beginRecord();
+            return true;
+        }
+        return fail("Поле " + currentKey + ": ожидается скалярное значение");
+    }
+
+    bool end_object() override {
+        if (stack.back() == Level::Record) endRecord();
+        stack.pop_back();
+        return true;
+    }
+
+    bool start_array(size_t) override {
+        bool itemsArray = itemsKey && (stack.empty() ||
+            (stack.back() == Level::Wrapper && currentKey == itemsKey));
+        if (!itemsArray) {
+            if (stack.empty()) return fail("Ожидается объект JSON");
+            return fail("Поле " + currentKey + ": ожидается скалярное значение");
+        }
+        stack.push_back(Level::Items);
+        return true;
+    }
+
+    bool end_array() override {
+        stack.pop_back();
+        return true;
+    }
+
+    bool key(string_t& name) override {
+        currentKey = name;
+        if (stack.back() == Level::Wrapper) {
+            if (name == itemsKey || isCredential(name)) return true;
+            return fail("Неизвестное поле " + name);
+        }
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (name == fields[i].name) {
+                field = &fields[i];
+                present |= 1ull << i;
+                return true;
+            }
+        }
+        if (stack.size() == 1 && isCredential(name)) {
+            field = nullptr;
+            return true;
+        }
+        return fail("Неизвестное поле " + name);
+    }
+
+    bool parse_error(size_t position, const string_t&, const nlohmann::detail::exception&) override {
+        return fail("Некорректный JSON (позиция " + to_string(position) + ")");
+    }
+
+private:
+    enum class Level { Wrapper, Items, Record };
+
+    const vector<RequestField<T>>& fields;
+    const char* itemsKey;
+    size_t maxItems;
+    vector<Level> stack;
+    std::string currentKey;
+    const RequestField<T>* field;       // поле, к которому относится следующее значение
+    uint64_t present;                   // битовая маска встреченных полей записи
+
+    static bool isCredential(const std::string& name) {
+        return name == "username" || name == "password";
+    }
+
+    bool fail(const std::string& message) {
+        if (error.empty()) error = message;
+        return false;
+    }
+
+    void beginRecord() {
+        stack.push_back(Level::Record);
+        items.emplace_back();
+        field = nullptr;
+        present = 0;
+    }
+
+    void endRecord() {
+        ParsedItem<T>& item = items.back();
+        for (size_t i = 0; i < fields.size() && item.error.empty(); i++) {
+            if (fields[i].required && !(present & (1ull << i))) {
+                item.error = std::string("Не заполнено поле ") + fields[i].name;
+            }
+        }
+    }
+
+    bool scalar(RequestValue&& value) {
+        if (stack.empty()) return fail("Ожидается объект JSON");
+        switch (stack.back()) {
+        case Level::Wrapper:
+            if (currentKey == itemsKey) return fail("Поле " + currentKey + ": ожидается массив");
+            return true;
+        case Level::Items:
+            // Не объект среди записей - ошибка только этой записи
+            if (items.size() >= maxItems) return fail("Не более " + to_string(maxItems) + " записей за запрос");
+            items.emplace_back();
+            items.back().error = "Запись должна быть объектом";
+            return true;
+        case Level::Record:
+            if (field && field->assign && !field->assign(items.back().value, value) && items.back().error.empty()) {
+                items.back().error = std::string("Некорректное значение поля ") + field->name;
+            }
+            field = nullptr;
+            return true;
+        }
+        return true;
+    }
+};
+
+namespace request {
+
+    inline void checkSize(const string& body, size_t maxBytes) {
+        if (body.size() > maxBytes) {
+            throw PayloadTooLargeException("Тело запроса больше " + to_string(maxBytes) + " байт");
+        }
+    }
+
+    // Один объект; ошибка разбора или поля - invalid_argument
+    template<typename T>
+    T parseRecord(const string& body, const vector<RequestField<T>>& fields, size_t maxBytes) {
+        checkSize(body, maxBytes);
+        RecordSax<T> sax(fields, nullptr, 1);
+        if (!nlohmann::json::sax_parse(body, &sax)) {
+            throw invalid_argument(sax.error.empty() ? "Некорректный JSON" : sax.error);
+        }
+        if (sax.items.empty()) throw invalid_argument("Ожидается объект JSON");
+        if (!sax.items[0].error.empty()) throw invalid_argument(sax.items[0].error);
+        return move(sax.items[0].value);
+    }
+
+    // Массив записей: ошибки отдельных записей возвращаются в ParsedItem::error,
+    // ошибка формы тела - invalid_argument
+    template<typename T>
+    vector<ParsedItem<T>> parseRecords(const string& body, const vector<RequestField<T>>& fields,
+        const char* itemsKey, size_t maxBytes, size_t maxItems) {
+        checkSize(body, maxBytes);
+        RecordSax<T> sax(fields, itemsKey, maxItems);
+        if (!nlohmann::json::sax_parse(body, &sax)) {
+            throw invalid_argument(sax.error.empty() ? "Некорректный JSON" : sax.error);
+        }
+        return move(sax.items);
+    }
+}
@@ -0,0 +1,188 @@
+﻿#pragma once
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+using namespace std;
+
+// Сжатие ответов включается при сборке: RESPONSE_COMPRESSION_GZIP (zlib)
+// и/или RESPONSE_COMPRESSION_ZSTD (libzstd), библиотеки подключаются к проекту.
+// В проекте по умолчанию ни один кодек не подключен - клиенту всегда уходит
+// несжатый ответ, а negotiate() и makeCompressor() сводятся к заглушкам
+#if (defined(RESPONSE_COMPRESSION_GZIP) || defined(RESPONSE_COMPRESSION_ZSTD)) && \
+    (defined(CPPHTTPLIB_ZLIB_SUPPORT) || defined(CPPHTTPLIB_ZSTD_SUPPORT) || defined(CPPHTTPLIB_BROTLI_SUPPORT))
+#error "httplib сам сжимает application/json - вместе с RESPONSE_COMPRESSION_* ответ сжимался бы дважды"
+#endif
+#ifdef RESPONSE_COMPRESSION_GZIP
+#include <zlib.h>
+#endif
+#ifdef RESPONSE_COMPRESSION_ZSTD
+#include <zstd.h>
+#endif
+
+enum class ContentEncoding { Identity, Gzip, Zstd };
+
+struct CompressionConfig {
+    bool enabled = true;
+    size_t minSize = 1024;      // ответы меньше отправляются без сжатия
+    int gzipLevel = 6;
+    int zstdLevel = 3;
+};
+
+// Потоковый компрессор: части подаются по мере готовности ответа,
+// last - последняя часть. После каждой части сжатое сбрасывается
+// в out, чтобы клиент мог разбирать chunked-ответ не дожидаясь конца
+class StreamCompressor {
+public:
+    virtual ~StreamCompressor() {}
+    virtual bool compress(const char* data, size_t size, bool last, string& out) = 0;
+};
+
+#ifdef RESPONSE_COMPRESSION_GZIP
+class GzipCompressor : public StreamCompressor {
+public:
+    explicit GzipCompressor(int level) : stream() {
+        // 15 + 16: окно 32 КБ с заголовком gzip
+        ready = deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    ~GzipCompressor() {
+        if (ready) deflateEnd(&stream);
+    }
+
+    bool compress(const char* data, size_t size, bool last, string& out) override {
+        if (!ready) return false;
+        int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = (uInt)size;
+        char buffer[16384];
+        int result;
+        do {
+            stream.next_out = reinterpret_cast<Bytef*>(buffer);
+            stream.avail_out = sizeof(buffer);
+            result = deflate(&stream, flush);
+            if (result == Z_STREAM_ERROR) return false;
+            out.append(buffer, sizeof(buffer) - stream.avail_out);
+        } while (stream.avail_out == 0);
+        return !last || result == Z_STREAM_END;
+    }
+
+private:
+    z_stream stream;
+    bool ready;
+};
+#endif
+
+#ifdef RESPONSE_COMPRESSION_ZSTD
+class ZstdCompressor : public StreamCompressor {
+public:
+    explicit ZstdCompressor(int level) : context(ZSTD_createCCtx()) {
+        if (context) ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level);
+    }
+    ~ZstdCompressor() {
+        ZSTD_freeCCtx(context);
+    }
+
+    bool compress(const char* data, size_t size, bool last, string& out) override {
+        if (!context) return false;
+        ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_flush;
+        ZSTD_inBuffer input = { data, size, 0 };
+        char buffer[16384];
+        size_t remaining;
+        do {
+            ZSTD_outBuffer output = { buffer, sizeof(buffer), 0 };
+            remaining = ZSTD_compressStream2(context, &output, &input, mode);
+            if (ZSTD_isError(remaining)) return false;
+            out.append(buffer, output.pos);
+        } while (remaining != 0);
+        return true;
+    }
+
+private:
+    ZSTD_CCtx* context;
+};
+#endif
+
+namespace compression {
+
+    inline bool available() {
+#if defined(RESPONSE_COMPRESSION_GZIP) || defined(RESPONSE_COMPRESSION_ZSTD)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Значение для заголовка Content-Encoding
+    inline const char* name(ContentEncoding encoding) {
+        switch (encoding) {
+        case ContentEncoding::Gzip: return "gzip";
+        case ContentEncoding::Zstd: return "zstd";
+        default: return "identity";
+        }
+    }
+
+    // Выбор кодирования по Accept-Encoding ("gzip, zstd;q=0.9, *;q=0"):
+    // среди собранных в сервер - с наибольшим q > 0, при равных - zstd.
+    // Кодирование, не упомянутое в заголовке, получает q от "*", если он есть
+    inline ContentEncoding negotiate([[maybe_unused]] const string& acceptEncoding) {
+#if !defined(RESPONSE_COMPRESSION_GZIP) && !defined(RESPONSE_COMPRESSION_ZSTD)
+        return ContentEncoding::Identity;
+#else
+        double gzip = -1, zstd = -1, any = -1;
+        size_t pos = 0;
+        while (pos < acceptEncoding.size()) {
+            size_t end = acceptEncoding.find(',', pos);
+            if (end == string::npos) end = acceptEncoding.size();
+            string_view item(acceptEncoding.data() + pos, end - pos);
+            pos = end + 1;
+
+            size_t semicolon = item.find(';');
+            string_view coding = item.substr(0, semicolon);
+            while (!coding.empty() && (coding.front() == ' ' || coding.front() == '\t')) coding.remove_prefix(1);
+            while (!coding.empty() && (coding.back() == ' ' || coding.back() == '\t')) coding.remove_suffix(1);
+
+            double q = 1;
+            if (semicolon != string_view::npos) {
+                size_t qpos = item.find("q=", semicolon);
+                if (qpos != string_view::npos) q = atof(string(item.substr(qpos + 2)).c_str());
+            }
+
+            if (coding == "gzip" || coding == "x-gzip") gzip = q;
+            else if (coding == "zstd") zstd = q;
+            else if (coding == "*") any = q;
+        }
+        if (gzip < 0) gzip = any;
+        if (zstd < 0) zstd = any;
+
+        ContentEncoding best = ContentEncoding::Identity;
+        double bestQ = 0;
+#ifdef RESPONSE_COMPRESSION_ZSTD
+        if (zstd > bestQ) {
+            best = ContentEncoding::Zstd;
+            bestQ = zstd;
+        }
+#endif
+#ifdef RESPONSE_COMPRESSION_GZIP
+        if (gzip > bestQ) {
+            best = ContentEncoding::Gzip;
+            bestQ = gzip;
+        }
+#endif
+        return best;
+#endif
+    }
+
+    // nullptr - для этого кодирования сжатие не собрано
+    inline unique_ptr<StreamCompressor> makeCompressor(ContentEncoding encoding,
+        [[maybe_unused]] const CompressionConfig& config) {
+        switch (encoding) {
+#ifdef RESPONSE_COMPRESSION_GZIP
+        case ContentEncoding::Gzip: return make_unique<GzipCompressor>(config.gzipLevel);
+#endif
+#ifdef RESPONSE_COMPRESSION_ZSTD
+        case ContentEncoding::Zstd: return make_unique<ZstdCompressor>(config.zstdLevel);
+#endif
+        default: return nullptr;
+        }
+    }
+}
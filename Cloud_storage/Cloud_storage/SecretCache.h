@@ -0,0 +1,153 @@
+﻿#pragma once
+#include "DataBase.h"
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+struct SecretCacheConfig {
+    size_t capacity = 4096;     // секретов в кэше, всего по всем сегментам
+    size_t shards = 16;
+};
+
+// Кэш секретов по id перед DataBase::getSecretById: LRU, разбитый на сегменты
+// со своими мьютексами. Изменение или удаление секрета сбрасывает его запись.
+// Чтение из базы, начатое до сброса, не возвращает в кэш устаревшее значение:
+// put принимает версию сегмента, полученную до чтения, и при расхождении
+// запись отбрасывается. Сброс из обработчика происходит уже после фиксации,
+// поэтому каждая запись помечена версией секрета из ChangeVersions (она растет
+// при фиксации): запись с другой версией считается отсутствующей, и между
+// фиксацией и сбросом кэш не отдает устаревший секрет под новым ETag
+class SecretCache {
+public:
+    struct Stats {
+        size_t size;
+        size_t capacity;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t invalidations;
+    };
+
+    explicit SecretCache(const SecretCacheConfig& config = SecretCacheConfig())
+        : shards(config.shards ? config.shards : 1), hits(0), misses(0), evictions(0), invalidations(0) {
+        shardCapacity = max<size_t>(1, (config.capacity + shards.size() - 1) / shards.size());
+    }
+
+    // Секрет из кэша, записанный при версии changeVersion; секрет с истекшим
+    // сроком или другой версией считается отсутствующим
+    optional<Secret> get(int secretId, uint64_t changeVersion) {
+        Shard& shard = shardOf(secretId);
+        lock_guard<mutex> lock(shard.lock);
+        auto it = shard.index.find(secretId);
+        if (it == shard.index.end()) {
+            misses++;
+            return nullopt;
+        }
+        const Secret& secret = it->second->secret;
+        if (it->second->changeVersion != changeVersion ||
+            (secret.expires_at != 0 && secret.expires_at <= timestamp::nowMicros())) {
+            shard.entries.erase(it->second);
+            shard.index.erase(it);
+            misses++;
+            return nullopt;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        hits++;
+        return secret;
+    }
+
+    // Версия сегмента; запрашивается перед чтением секрета из базы
+    uint64_t version(int secretId) {
+        Shard& shard = shardOf(secretId);
+        lock_guard<mutex> lock(shard.lock);
+        return shard.version;
+    }
+
+    // Сохранение прочитанного из базы секрета; changeVersion - версия секрета,
+    // полученная до чтения. false - запись сегмента сбрасывалась после
+    // получения version, значение могло устареть
+    bool put(const Secret& secret, uint64_t version, uint64_t changeVersion) {
+        Shard& shard = shardOf(secret.id_secrets);
+        lock_guard<mutex> lock(shard.lock);
+        if (shard.version != version) return false;
+
+        auto it = shard.index.find(secret.id_secrets);
+        if (it != shard.index.end()) {
+            *it->second = { secret, changeVersion };
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            return true;
+        }
+        if (shard.entries.size() >= shardCapacity) {
+            shard.index.erase(shard.entries.back().secret.id_secrets);
+            shard.entries.pop_back();
+            evictions++;
+        }
+        shard.entries.push_front({ secret, changeVersion });
+        shard.index[secret.id_secrets] = shard.entries.begin();
+        return true;
+    }
+
+    void invalidate(int secretId) {
+        Shard& shard = shardOf(secretId);
+        lock_guard<mutex> lock(shard.lock);
+        shard.version++;
+        auto it = shard.index.find(secretId);
+        if (it == shard.index.end()) return;
+        shard.entries.erase(it->second);
+        shard.index.erase(it);
+        invalidations++;
+    }
+
+    void invalidate(const vector<int>& secretIds) {
+        for (int id : secretIds) invalidate(id);
+    }
+
+    void clear() {
+        for (auto& shard : shards) {
+            lock_guard<mutex> lock(shard.lock);
+            shard.version++;
+            invalidations += shard.entries.size();
+            shard.entries.clear();
+            shard.index.clear();
+        }
+    }
+
+    Stats stats() {
+        size_t size = 0;
+        for (auto& shard : shards) {
+            lock_guard<mutex> lock(shard.lock);
+            size += shard.entries.size();
+        }
+        return { size, shardCapacity * shards.size(), hits.load(), misses.load(),
+            evictions.load(), invalidations.load() };
+    }
+
+private:
+    struct Entry {
+        Secret secret;
+        uint64_t changeVersion;     // ChangeVersions::secretVersion на момент чтения
+    };
+
+    struct Shard {
+        mutex lock;
+        list<Entry> entries;                                // от недавно использованных к давним
+        unordered_map<int, list<Entry>::iterator> index;
+        uint64_t version = 0;                               // растет при каждом сбросе
+    };
+
+    vector<Shard> shards;
+    size_t shardCapacity;
+    atomic<uint64_t> hits;
+    atomic<uint64_t> misses;
+    atomic<uint64_t> evictions;
+    atomic<uint64_t> invalidations;
+
+    Shard& shardOf(int secretId) {
+        return shards[(size_t)(unsigned)secretId % shards.size()];
+    }
+};
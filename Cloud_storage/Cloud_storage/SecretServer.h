@@ -1,161 +1,742 @@
 #pragma once
 #include "httplib.h"
 #include "DataBase.h"
+#include "AuditPipeline.h"
+#include "SessionStore.h"
+#include "PasswordHasher.h"
+#include "ExpirySweeper.h"
+#include "SecretCache.h"
+#include "JsonWriter.h"
+#include "RequestParser.h"
+#include "ResponseCompression.h"
+#include "LoadSheddingQueue.h"
 #include <iostream>
 #include "json.hpp"
 #include <ctime>
 #include <functional>
+#include <optional>
+#include <memory>
 using json = nlohmann::json;
 using namespace std;
 
 class SecretServer {
 private:
-    httplib::Server server;
+    SheddingServer server;
     DataBase& db;
+    AuditPipeline audit;
+    SessionStore sessions;
+    PasswordHasher hasher;
+    ExpirySweeper expiry;
+    SecretCache cache;
+    CompressionConfig compression;
+    ServerConfig serverConfig;
+    LoadSheddingQueue* connections;     //  httplib  listen,    
 
 public:
-    SecretServer() : db(DataBase::getInstance()) {}
+    SecretServer(const AuditPipelineConfig& auditConfig = AuditPipelineConfig(),
+        const SessionConfig& sessionConfig = SessionConfig(),
+        const PasswordHasherConfig& hasherConfig = PasswordHasherConfig(),
+        const ExpirySweeperConfig& expiryConfig = ExpirySweeperConfig(),
+        const SecretCacheConfig& cacheConfig = SecretCacheConfig(),
+        const CompressionConfig& compressionConfig = CompressionConfig(),
+        const ServerConfig& serverConfig = ServerConfig())
+        : db(DataBase::getInstance()), audit(db, auditConfig), sessions(sessionConfig),
+        hasher(hasherConfig), expiry(db, expiryConfig), cache(cacheConfig), compression(compressionConfig),
+        serverConfig(serverConfig), connections(nullptr) {
+        expiry.onDeleted([this](const vector<int>& ids) { cache.invalidate(ids); });
+    }
 
     /* =====   ===== */
-    static string getCurrentDateTime() {
-        time_t now = time(nullptr);
-        tm localTime;
-        localtime_s(&localTime, &now);
-        char buffer[20];
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &localTime);
-        return buffer;
+    //  ;   -   ?pretty=1.  
+    //  ,      
+    static bool& prettyOutput() {
+        thread_local bool pretty = false;
+        return pretty;
+    }
+
+    //  :    Accept-Encoding 
+    // ,     pretty
+    struct ResponseEncoding {
+        ContentEncoding encoding = ContentEncoding::Identity;
+        const CompressionConfig* config = nullptr;
+    };
+
+    static ResponseEncoding& responseEncoding() {
+        thread_local ResponseEncoding encoding;
+        return encoding;
+    }
+
+    //  ;   config.minSize    
+    static void setBody(httplib::Response& res, string&& body, const char* contentType) {
+        const ResponseEncoding& choice = responseEncoding();
+        if (choice.encoding != ContentEncoding::Identity && body.size() >= choice.config->minSize) {
+            auto compressor = compression::makeCompressor(choice.encoding, *choice.config);
+            string compressed;
+            if (compressor && compressor->compress(body.data(), body.size(), true, compressed)) {
+                body.swap(compressed);
+                res.set_header("Content-Encoding", compression::name(choice.encoding));
+            }
+        }
+        if (compression::available()) res.set_header("Vary", "Accept-Encoding");
+        res.set_content(move(body), contentType);
+    }
+
+    //   chunked-:   ,  
+    //   -    . nullptr -  
+    static shared_ptr<StreamCompressor> streamCompressor(httplib::Response& res) {
+        const ResponseEncoding& choice = responseEncoding();
+        if (compression::available()) res.set_header("Vary", "Accept-Encoding");
+        if (choice.encoding == ContentEncoding::Identity) return nullptr;
+        shared_ptr<StreamCompressor> compressor = compression::makeCompressor(choice.encoding, *choice.config);
+        if (compressor) res.set_header("Content-Encoding", compression::name(choice.encoding));
+        return compressor;
     }
 
-    static string hashPassword(const string& password) {
-        hash<string> hasher;
-        return to_string(hasher(password));
+    //  chunked-,  ,   
+    static bool writeChunk(httplib::DataSink& sink, StreamCompressor* compressor, const string& chunk, bool last) {
+        if (!compressor) return chunk.empty() || sink.write(chunk.data(), chunk.size());
+        string compressed;
+        if (!compressor->compress(chunk.data(), chunk.size(), last, compressed)) return false;
+        return compressed.empty() || sink.write(compressed.data(), compressed.size());
     }
 
     static void sendJson(httplib::Response& res, int status, const json& data) {
         res.status = status;
-        res.set_content(data.dump(4), "application/json");
+        //        UTF-8 -   ,    
+        setBody(res, data.dump(prettyOutput() ? 4 : -1, ' ', false, json::error_handler_t::replace),
+            "application/json");
     }
 
     static void sendError(httplib::Response& res, int status, const string& msg) {
         sendJson(res, status, { {"error", msg} });
     }
 
+    // :      ServerConfig::retryAfter
+    void sendBusy(httplib::Response& res, const string& msg) const {
+        // ETag     ,   503   
+        res.headers.erase("ETag");
+        res.set_header("Retry-After", to_string(serverConfig.retryAfter.count()));
+        sendError(res, 503, msg);
+    }
+
     static void sendSuccess(httplib::Response& res, const json& data = {}) {
         json j = { {"success", true} };
         if (!data.empty()) j["data"] = data;
         sendJson(res, 200, j);
     }
+
+    //         ,   json
+    static void writeSecret(JsonWriter& w, const Secret& s) {
+        w.beginObject()
+            .field("id_secrets", s.id_secrets)
+            .field("owner_id", s.owner_id)
+            .field("secret_value", s.secret_value)
+            .field("secret_type", s.secret_type)
+            .field("created_at", timestamp::format(s.created_at))
+            .field("expires_at", timestamp::format(s.expires_at))
+            .endObject();
+    }
+
+    static void writeUser(JsonWriter& w, const User& u) {
+        w.beginObject()
+            .field("id_user", u.id_user)
+            .field("username", u.username)
+            .field("role", u.role)
+            .field("is_active", u.is_active)
+            .field("created_at", timestamp::format(u.created_at))
+            .endObject();
+    }
+
+    static void writeAuditLog(JsonWriter& w, const AuditLog& log) {
+        w.beginObject()
+            .field("id_audit_logs", log.id_audit_logs)
+            .key("user_id");
+        //   - null
+        if (log.user_id) w.value(log.user_id);
+        else w.null();
+        w.field("action", log.action)
+            .field("object_type", log.object_type)
+            .field("object_id", log.object_id)
+            .field("created_at", timestamp::format(log.created_at))
+            .endObject();
+    }
+
+    // {"data":<...>,"success":true};  data  writeData
+    template<typename WriteData>
+    static void sendSuccessWith(httplib::Response& res, WriteData writeData) {
+        JsonWriter w(prettyOutput());
+        w.beginObject().key("data");
+        writeData(w);
+        w.field("success", true).endObject();
+        res.status = 200;
+        setBody(res, w.release(), "application/json");
+    }
+
+    // {"data":{"<key>":[...]},"success":true}
+    template<typename T>
+    static void sendItems(httplib::Response& res, const char* key, const vector<T>& items,
+        void(*write)(JsonWriter&, const T&)) {
+        sendSuccessWith(res, [&](JsonWriter& w) {
+            w.beginObject().key(key).beginArray();
+            for (const T& item : items) write(w, item);
+            w.endArray().endObject();
+            });
+    }
+
+    // {"data":{"<key>":[...],"next_cursor":...},"success":true}
+    template<typename T>
+    static void sendPage(httplib::Response& res, const char* key, const Page<T>& page,
+        void(*write)(JsonWriter&, const T&)) {
+        sendSuccessWith(res, [&](JsonWriter& w) {
+            w.beginObject().key(key).beginArray();
+            for (const T& item : page.items) write(w, item);
+            w.endArray().key("next_cursor");
+            if (page.hasMore) w.value(encodeCursor(page.next));
+            else w.null();
+            w.endObject();
+            });
+    }
+
+    /* =====   (ETag) ===== */
+    //    DataBase::getChangeVersions()   , 
+    //      ETag.     
+    //       -   ExpirySweeper ( 
+    // )      304.
+    // ETag :  Accept-Encoding   ,   
+    string entityTag(const httplib::Request& req, const string& scope, uint64_t version) {
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "W/\"%llx-%s-%llx-%zx\"",
+            (unsigned long long)db.getChangeVersions().epoch(), scope.c_str(),
+            (unsigned long long)version, hash<string>()(req.target));
+        return buffer;
+    }
+
+    // true -    If-None-Match ,  304  
+    static bool notModified(const httplib::Request& req, httplib::Response& res, const string& tag) {
+        const string header = req.get_header_value("If-None-Match");
+        string_view expected = string_view(tag).substr(2);      //  "W/"
+        size_t pos = 0;
+        while (pos < header.size()) {
+            size_t end = header.find(',', pos);
+            if (end == string::npos) end = header.size();
+            string_view candidate(header.data() + pos, end - pos);
+            pos = end + 1;
+
+            while (!candidate.empty() && candidate.front() == ' ') candidate.remove_prefix(1);
+            while (!candidate.empty() && candidate.back() == ' ') candidate.remove_suffix(1);
+            if (candidate.substr(0, 2) == "W/") candidate.remove_prefix(2);
+            if (candidate == expected) {
+                res.status = 304;
+                res.set_header("ETag", tag);
+                if (compression::available()) res.set_header("Vary", "Accept-Encoding");
+                return true;
+            }
+        }
+        return false;
+    }
+
+    string secretsTag(const httplib::Request& req, const Identity& identity) {
+        const ChangeVersions& versions = db.getChangeVersions();
+        if (identity.isAdmin()) return entityTag(req, "secrets", versions.secretsVersion());
+        return entityTag(req, "owner" + to_string(identity.userId), versions.ownerVersion(identity.userId));
+    }
+
+    string usersTag(const httplib::Request& req, const Identity& identity) {
+        return entityTag(req, identity.isAdmin() ? string("users") : "user" + to_string(identity.userId),
+            db.getChangeVersions().usersVersion());
+    }
+
+    /* =====   ===== */
+    static constexpr size_t STREAM_ROWS_PER_CHUNK = 256;
+
+    //   chunked-   ,  STREAM_ROWS_PER_CHUNK 
+    //  ,       .
+    //    sendSuccess: {"data":{"<key>":[...]},"success":true}.
+    //        ,  
+    //      (DatabaseBusyException - 503)
+    template<typename T>
+    void sendJsonStream(httplib::Response& res, const string& key,
+        RowCursor<T>&& rows, void(*write)(JsonWriter&, const T&)) {
+        struct State {
+            ConnectionPool::StreamSlot slot;
+            RowCursor<T> rows;
+            JsonWriter writer;      //     
+            shared_ptr<StreamCompressor> compressor;
+        };
+        auto state = make_shared<State>(State{ db.acquireStreamSlot(), move(rows),
+            JsonWriter(prettyOutput()), streamCompressor(res) });
+        state->writer.beginObject().key("data").beginObject().key(key).beginArray();
+
+        res.status = 200;
+        res.set_chunked_content_provider("application/json",
+            [state, write](size_t, httplib::DataSink& sink) {
+                JsonWriter& w = state->writer;
+                bool more = true;
+                try {
+                    for (size_t n = 0; n < STREAM_ROWS_PER_CHUNK; n++) {
+                        if (!state->rows.next()) {
+                            more = false;
+                            break;
+                        }
+                        write(w, state->rows.row());
+                    }
+                }
+                catch (const exception& e) {
+                    cerr << "  : " << e.what() << endl;
+                    return false;
+                }
+
+                if (!more) w.endArray().endObject().field("success", true).endObject();
+                if (!writeChunk(sink, state->compressor.get(), w.buffer(), !more)) return false;
+                w.clear();
+                if (!more) sink.done();
+                return true;
+            });
+    }
+
+    //    NDJSON:    , chunked-
+    //  .      ,  
+    //       id (after_id).
+    //     ,   sendJsonStream
+    template<typename T>
+    void sendNdjsonStream(httplib::Response& res, RowCursor<T>&& rows, void(*write)(JsonWriter&, const T&)) {
+        auto slot = make_shared<ConnectionPool::StreamSlot>(db.acquireStreamSlot());
+        auto cursor = make_shared<RowCursor<T>>(move(rows));
+        auto compressor = streamCompressor(res);
+
+        res.status = 200;
+        res.set_chunked_content_provider("application/x-ndjson",
+            [slot, cursor, compressor, write](size_t, httplib::DataSink& sink) {
+                JsonWriter w;
+                string& chunk = w.buffer();
+                bool more = true;
+                try {
+                    for (size_t n = 0; n < STREAM_ROWS_PER_CHUNK; n++) {
+                        if (!cursor->next()) {
+                            more = false;
+                            break;
+                        }
+                        write(w, cursor->row());
+                        chunk += '\n';
+                    }
+                }
+                catch (const exception& e) {
+                    cerr << " : " << e.what() << endl;
+                    return false;
+                }
+
+                if (!writeChunk(sink, compressor.get(), chunk, !more)) return false;
+                if (!more) sink.done();
+                return true;
+            });
+    }
+
+    static long long parseAfterId(const httplib::Request& req) {
+        if (!req.has_param("after_id")) return 0;
+        string value = req.get_param_value("after_id");
+        if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != string::npos) {
+            throw invalid_argument(" after_id");
+        }
+        return stoll(value);
+    }
+
+    /* =====   ===== */
+    static constexpr size_t DEFAULT_PAGE_LIMIT = 100;
+    static constexpr size_t MAX_PAGE_LIMIT = 1000;
+
+    struct PageRequest {
+        size_t limit = DEFAULT_PAGE_LIMIT;
+        optional<PageCursor> after;
+    };
+
+    //    : hex- "created_at|id" (  )
+    static string encodeCursor(const PageCursor& cursor) {
+        static const char digits[] = "0123456789abcdef";
+        string raw = to_string(cursor.created_at) + "|" + to_string(cursor.id);
+        string out;
+        out.reserve(raw.size() * 2);
+        for (unsigned char c : raw) {
+            out += digits[c >> 4];
+            out += digits[c & 0x0F];
+        }
+        return out;
+    }
+
+    static PageCursor decodeCursor(const string& token) {
+        auto hexValue = [](char c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        };
+        if (token.empty() || token.size() % 2 != 0) throw invalid_argument(" cursor");
+
+        string raw;
+        raw.reserve(token.size() / 2);
+        for (size_t i = 0; i < token.size(); i += 2) {
+            int hi = hexValue(token[i]), lo = hexValue(token[i + 1]);
+            if (hi < 0 || lo < 0) throw invalid_argument(" cursor");
+            raw += (char)(hi * 16 + lo);
+        }
+
+        size_t sep = raw.find('|');
+        if (sep == 0 || sep > 18 || sep == string::npos || sep + 1 == raw.size() || raw.size() - sep > 10) {
+            throw invalid_argument(" cursor");
+        }
+        for (size_t i = 0; i < raw.size(); i++) {
+            if (i != sep && (raw[i] < '0' || raw[i] > '9')) throw invalid_argument(" cursor");
+        }
+        PageCursor cursor;
+        cursor.created_at = stoll(raw.substr(0, sep));
+        cursor.id = stoi(raw.substr(sep + 1));
+        return cursor;
+    }
+
+    //   limit  cursor. false -     
+    static bool parsePageRequest(const httplib::Request& req, PageRequest& page) {
+        bool hasLimit = req.has_param("limit");
+        bool hasCursor = req.has_param("cursor");
+        if (!hasLimit && !hasCursor) return false;
+
+        if (hasLimit) {
+            string value = req.get_param_value("limit");
+            if (value.empty() || value.size() > 6 ||
+                value.find_first_not_of("0123456789") != string::npos) {
+                throw invalid_argument(" limit");
+            }
+            page.limit = (size_t)stoul(value);
+            if (page.limit == 0) throw invalid_argument(" limit");
+            page.limit = min(page.limit, MAX_PAGE_LIMIT);
+        }
+        if (hasCursor) {
+            page.after = decodeCursor(req.get_param_value("cursor"));
+        }
+        return true;
+    }
+
+    //  (UTC)   "YYYY-MM-DD"  "YYYY-MM-DD HH:MM:SS"
+    static optional<int64_t> parseTimestampParam(const httplib::Request& req, const char* name) {
+        string value = req.get_param_value(name);
+        if (value.empty()) return nullopt;
+        int64_t micros = 0;
+        if (!timestamp::parse(value, micros)) throw invalid_argument(string("  ") + name);
+        return micros;
+    }
+
+    //   : user_id, from, to, action, object_type
+    static AuditFilter parseAuditFilter(const httplib::Request& req) {
+        AuditFilter filter;
+        if (req.has_param("user_id")) {
+            string value = req.get_param_value("user_id");
+            if (value.empty() || value.size() > 9 ||
+                value.find_first_not_of("0123456789") != string::npos) {
+                throw invalid_argument(" user_id");
+            }
+            filter.userId = stoi(value);
+        }
+        filter.from = parseTimestampParam(req, "from");
+        filter.to = parseTimestampParam(req, "to");
+        filter.action = req.get_param_value("action");
+        filter.objectType = req.get_param_value("object_type");
+        return filter;
+    }
+
+    //    expires_in_days ( Unix); 0 - 
+    static int64_t expiryDeadline(int expiresInDays) {
+        if (expiresInDays <= 0) return 0;
+        return timestamp::nowMicros() + (int64_t)expiresInDays * 24 * 3600 * timestamp::MICROS_PER_SECOND;
+    }
+
+    /* =====    ===== */
+    //   SAX-    ,   json.
+    //      - 400,    - 413
+    static constexpr size_t MAX_BODY_BYTES = 1 << 20;
+    static constexpr size_t MAX_BATCH_BODY_BYTES = 64 << 20;
+
+    struct SecretInput {
+        Secret secret;
+        int expiresInDays = 0;
+        string username;            //  ,    
+        string password;
+    };
+
+    struct UserInput {
+        string username;
+        string password;
+        string role = "user";
+    };
+
+    struct Credentials {
+        string username;
+        string password;
+    };
+
+    //  ; owner_id    ,    .
+    //           
+    static const vector<RequestField<SecretInput>>& secretFields(bool create) {
+        static const vector<RequestField<SecretInput>> fields[2] = { {
+                { "owner_id", false, [](SecretInput& in, RequestValue& v) { return v.toInt(in.secret.owner_id); } },
+                { "secret_value", true, [](SecretInput& in, RequestValue& v) { return v.take(in.secret.secret_value); } },
+                { "secret_type", true, [](SecretInput& in, RequestValue& v) { return v.take(in.secret.secret_type); } },
+                { "expires_in_days", false, [](SecretInput& in, RequestValue& v) { return v.toInt(in.expiresInDays); } },
+                { "username", false, [](SecretInput& in, RequestValue& v) { return v.take(in.username); } },
+                { "password", false, [](SecretInput& in, RequestValue& v) { return v.take(in.password); } },
+            }, {
+                { "owner_id", true, [](SecretInput& in, RequestValue& v) { return v.toInt(in.secret.owner_id); } },
+                { "secret_value", true, [](SecretInput& in, RequestValue& v) { return v.take(in.secret.secret_value); } },
+                { "secret_type", true, [](SecretInput& in, RequestValue& v) { return v.take(in.secret.secret_type); } },
+                { "expires_in_days", false, [](SecretInput& in, RequestValue& v) { return v.toInt(in.expiresInDays); } },
+            } };
+        return fields[create ? 1 : 0];
+    }
+
+    static const vector<RequestField<UserInput>>& userFields() {
+        static const vector<RequestField<UserInput>> fields = {
+            { "username", true, [](UserInput& in, RequestValue& v) { return v.take(in.username); } },
+            { "password", true, [](UserInput& in, RequestValue& v) { return v.take(in.password); } },
+            { "role", false, [](UserInput& in, RequestValue& v) { return v.take(in.role); } },
+        };
+        return fields;
+    }
+
+    static const vector<RequestField<Credentials>>& credentialFields() {
+        static const vector<RequestField<Credentials>> fields = {
+            { "username", false, [](Credentials& in, RequestValue& v) { return v.take(in.username); } },
+            { "password", false, [](Credentials& in, RequestValue& v) { return v.take(in.password); } },
+        };
+        return fields;
+    }
+
     /* =====     ===== */
-    string authenticateAndGetRole(const string& username, const string& password) {
+    //     hasher;   
+    // HasherBusyException       503
+    optional<Identity> authenticateUser(const string& username, const string& password) {
         try {
-            if (db.authenticate(username, hashPassword(password))) {
-                User user = db.getUserByUsername(username);
-                return user.role;
+            auto result = db.getCredentials(username);
+            if (!result || !result->is_active) {
+                //      ,  
+                hasher.verifyAbsent(password);
+                return nullopt;
             }
-            else {
-                return "";
+
+            auto check = hasher.verify(password, result->password_hash);
+            if (!check.valid) return nullopt;
+            if (!check.rehash.empty()) {
+                //       -   
+                db.updatePasswordHashAsync(result->id_user, check.rehash);
             }
+            return Identity(result->id_user, result->username, result->role);
+        }
+        catch (const DatabaseBusyException&) {
+            throw;      // ,     -   503
         }
         catch (const DatabaseException& e) {
             cerr << " : " << e.what() << endl;
-            return "";
+            return nullopt;
+        }
+    }
+
+    //  : "Authorization: Bearer <>"  "X-Session-Token: <>"
+    static string sessionToken(const httplib::Request& req) {
+        static const string bearer = "Bearer ";
+        string header = req.get_header_value("Authorization");
+        if (header.compare(0, bearer.size(), bearer) == 0) return header.substr(bearer.size());
+        return req.get_header_value("X-Session-Token");
+    }
+
+    //  :    -     ;
+    //   -       ,  
+    Identity identify(const httplib::Request& req) {
+        string token = sessionToken(req);
+        if (!token.empty()) {
+            auto identity = sessions.resolve(token);
+            if (!identity) throw runtime_error("   ");
+            return *identity;
+        }
+
+        Credentials credentials;
+        try {
+            credentials = request::parseRecord(req.body, credentialFields(), MAX_BODY_BYTES);
         }
+        catch (const invalid_argument&) {
+            throw runtime_error(" ");
+        }
+        auto identity = authenticateUser(credentials.username, credentials.password);
+        if (!identity) throw runtime_error(" ");
+        return *identity;
     }
-    vector<Secret> getSecretsByRole(const string& username, const string& password) {
-        string role = authenticateAndGetRole(username, password);
-        if (role.empty()) throw runtime_error(" ");
 
-        if (role == "admin") {
-            return db.getAllSecrets();
+    //     :      
+    //    .       ,
+    //    (  )   - 0,   NULL
+    int auditActor(const httplib::Request& req, const string& username, const string& password) {
+        string token = sessionToken(req);
+        optional<Identity> identity;
+        if (!token.empty()) identity = sessions.resolve(token);
+        else if (!username.empty()) identity = authenticateUser(username, password);
+        return identity ? identity->userId : 0;
+    }
+    RowCursor<Secret> getSecretsByRole(const Identity& identity) {
+        if (identity.isAdmin()) {
+            return db.streamAllSecrets();
         }
         else {
-            User user = db.getUserByUsername(username);
-            return db.getSecretsByUser(user.id_user);
+            return db.streamSecretsByUser(identity.userId);
         }
     }
 
-    /* =====      ===== */
-    vector<User> getUsersByRole(const string& username, const string& password) {
-        string role = authenticateAndGetRole(username, password);
-        if (role.empty()) throw runtime_error(" ");
+    Page<Secret> getSecretsPageByRole(const Identity& identity, const PageRequest& page) {
+        if (identity.isAdmin()) {
+            return db.getSecretsPage(page.limit, page.after);
+        }
+        else {
+            return db.getSecretsByUserPage(identity.userId, page.limit, page.after);
+        }
+    }
+
+    /* =====      ===== */
+    static constexpr size_t DEFAULT_SEARCH_LIMIT = 50;
+    static constexpr size_t MAX_BATCH_ITEMS = 10000;
 
-        if (role == "admin") {
-            return db.getAllUsers();
+    vector<Secret> searchSecretsByRole(const Identity& identity, const string& query, size_t limit) {
+        if (identity.isAdmin()) {
+            return db.searchSecrets(query, limit);
         }
         else {
-            User user = db.getUserByUsername(username);
-            return { user };
+            return db.searchSecretsByOwner(identity.userId, query, limit);
         }
     }
 
-    /* =====  -    ===== */
-    vector<AuditLog> getAuditLogsByRole(const string& username, const string& password) {
-        string role = authenticateAndGetRole(username, password);
-        if (role.empty()) throw runtime_error(" ");
+    /* =====      ===== */
+    RowCursor<User> getUsersByRole(const Identity& identity) {
+        if (identity.isAdmin()) {
+            return db.streamAllUsers();
+        }
+        else {
+            return db.streamUserByUsername(identity.username);
+        }
+    }
 
-        if (role == "admin") {
-            return db.getAuditLogs();
+    Page<User> getUsersPageByRole(const Identity& identity, const PageRequest& page) {
+        if (identity.isAdmin()) {
+            return db.getUsersPage(page.limit, page.after);
         }
         else {
-            User user = db.getUserByUsername(username);
-            auto allLogs = db.getAuditLogs();
-            vector<AuditLog> filtered;
-            for (auto& log : allLogs) {
-                if (log.user_id == user.id_user) filtered.push_back(log);
-            }
-            return filtered;
+            Page<User> self;
+            if (!page.after) self.items.push_back(db.getUserById(identity.userId));
+            return self;
         }
     }
 
+    /* =====  -    ===== */
+    //    ,  -   
+    static AuditFilter scopeAuditFilter(const Identity& identity, AuditFilter filter) {
+        if (!identity.isAdmin()) {
+            filter.userId = identity.userId;
+        }
+        return filter;
+    }
+
+    RowCursor<AuditLog> getAuditLogsByRole(const Identity& identity, const AuditFilter& filter) {
+        return db.streamAuditLogsFiltered(scopeAuditFilter(identity, filter));
+    }
+
+    Page<AuditLog> getAuditLogsPageByRole(const Identity& identity, const AuditFilter& filter,
+        const PageRequest& page) {
+        return db.getAuditLogsFilteredPage(scopeAuditFilter(identity, filter), page.limit, page.after);
+    }
+
 
     /* =====   ===== */
     void initRoutes() {
+        server.set_pre_routing_handler([this](const httplib::Request& req, httplib::Response&) {
+            prettyOutput() = req.get_param_value("pretty") == "1";
+            responseEncoding() = { compression.enabled
+                ? compression::negotiate(req.get_header_value("Accept-Encoding"))
+                : ContentEncoding::Identity, &compression };
+            return httplib::Server::HandlerResponse::Unhandled;
+            });
+        //      try (, )
+        server.set_exception_handler([this](const httplib::Request&, httplib::Response& res, exception_ptr error) {
+            try {
+                rethrow_exception(error);
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const exception& e) {
+                sendError(res, 500, e.what());
+            }
+            catch (...) {
+                sendError(res, 500, "  ");
+            }
+            });
         server.set_default_headers({
             {"Access-Control-Allow-Origin", "*"},
             {"Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS"},
-            {"Access-Control-Allow-Headers", "Content-Type"}
+            {"Access-Control-Allow-Headers", "Content-Type, Authorization, X-Session-Token"}
             });
+        //      ( ) 
+        //  413  Content-Length,  
+        server.set_payload_max_length(MAX_BATCH_BODY_BYTES);
 
         server.Options(R"(/.*)", [](const httplib::Request&, httplib::Response& res) {
             res.set_content("", "text/plain");
             });
         server.Post("/api/users", [this](const httplib::Request& req, httplib::Response& res) {
             try {
-                auto j = json::parse(req.body);
-                if (!j.contains("username") || !j.contains("password")) {
-                    sendError(res, 400, "username  password ");
-                    return;
-                }
+                UserInput input = request::parseRecord(req.body, userFields(), MAX_BODY_BYTES);
                 User user;
-                user.username = j["username"];
-                user.password_hash = hashPassword(j["password"]);
-                user.role = j.value("role", "user");
+                user.username = move(input.username);
+                user.password_hash = hasher.hash(input.password);
+                user.role = move(input.role);
                 user.is_active = true;
                 int id = db.addUser(user);
-                db.addAuditLog(id, " ", "user", id);
+                audit.log(id, " ", "user", id);
                 sendSuccess(res, { {"user_id", id} });
             }
+            catch (const PayloadTooLargeException& e) {
+                sendError(res, 413, e.what());
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const ConflictException& e) {
+                sendError(res, 409, e.what());
+            }
+            catch (const HasherBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
+            }
             catch (const exception& e) {
                 sendError(res, 500, e.what());
             }
             });
         server.Get("/api/users", [this](const httplib::Request& req, httplib::Response& res) {
             try {
-                auto j = json::parse(req.body);
-                string username = j.value("username", "");
-                string password = j.value("password", "");
-                auto users = getUsersByRole(username, password);
-                json arr = json::array();
-                for (auto& u : users) {
-                    arr.push_back({
-                        {"id_user", u.id_user},
-                        {"username", u.username},
-                        {"role", u.role},
-                        {"is_active", u.is_active},
-                        {"created_at", u.created_at}
-                        });
+                Identity identity = identify(req);
+                PageRequest page;
+                bool paged = parsePageRequest(req, page);
+                string tag = usersTag(req, identity);
+                if (notModified(req, res, tag)) return;
+                res.set_header("ETag", tag);
+                if (paged) {
+                    auto result = getUsersPageByRole(identity, page);
+                    sendPage(res, "users", result, writeUser);
+                    return;
                 }
-                sendSuccess(res, { {"users", arr} });
+                sendJsonStream(res, "users", getUsersByRole(identity), writeUser);
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const HasherBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
             }
             catch (const exception& e) {
                 sendError(res, 401, e.what());
@@ -163,122 +744,332 @@ public:
             });
         server.Post("/api/auth/login", [this](const httplib::Request& req, httplib::Response& res) {
             try {
-                auto j = json::parse(req.body);
-                string username = j.value("username", "");
-                string password = j.value("password", "");
-                string role = authenticateAndGetRole(username, password);
-                if (!role.empty()) {
-                    sendSuccess(res, { {"message", " "}, {"role", role} });
+                Credentials credentials = request::parseRecord(req.body, credentialFields(), MAX_BODY_BYTES);
+                auto identity = authenticateUser(credentials.username, credentials.password);
+                if (identity) {
+                    string token = sessions.issue(*identity);
+                    sendSuccess(res, {
+                        {"message", " "},
+                        {"role", identity->role},
+                        {"user_id", identity->userId},
+                        {"token", token},
+                        {"expires_in", (long long)sessions.ttl().count()}
+                        });
                 }
                 else {
                     sendError(res, 401, " ");
                 }
             }
+            catch (const PayloadTooLargeException& e) {
+                sendError(res, 413, e.what());
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const HasherBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
+            }
             catch (const exception& e) {
                 sendError(res, 500, e.what());
             }
             });
+        server.Post("/api/auth/logout", [this](const httplib::Request& req, httplib::Response& res) {
+            string token = sessionToken(req);
+            if (token.empty() || !sessions.revoke(token)) {
+                sendError(res, 401, "   ");
+                return;
+            }
+            sendSuccess(res, { {"message", " "} });
+            });
         server.Post("/api/secrets", [this](const httplib::Request& req, httplib::Response& res) {
             try {
-                auto j = json::parse(req.body);
-                Secret s;
-                s.owner_id = j["owner_id"];
-                s.secret_value = j["secret_value"];
-                s.secret_type = j["secret_type"];
-                int expires_in_days = j.value("expires_in_days", 0);
-                if (expires_in_days > 0) {
-                    time_t now = time(nullptr);
-                    now += expires_in_days * 24 * 3600;
-                    char buffer[20];
-                    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&now));
-                    s.expires_at = buffer;
-                }
+                SecretInput input = request::parseRecord(req.body, secretFields(true), MAX_BODY_BYTES);
+                Secret& s = input.secret;
+                int64_t deadline = expiryDeadline(input.expiresInDays);
+                s.expires_at = deadline;
                 int id = db.addSecret(s);
-                db.addAuditLog(s.owner_id, " ", "secret", id);
+                if (deadline) expiry.track(id, deadline);
+                audit.log(s.owner_id, " ", "secret", id);
                 sendSuccess(res, { {"secret_id", id} });
             }
+            catch (const PayloadTooLargeException& e) {
+                sendError(res, 413, e.what());
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const ForeignKeyException& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const exception& e) {
+                sendError(res, 500, e.what());
+            }
+            });
+        //  : {"secrets": [...]}    .
+        //          
+        server.Post("/api/secrets/batch", [this](const httplib::Request& req, httplib::Response& res) {
+            try {
+                //    MAX_BATCH_ITEMS + 1- ,   
+                auto items = request::parseRecords(req.body, secretFields(true), "secrets",
+                    MAX_BATCH_BODY_BYTES, MAX_BATCH_ITEMS);
+
+                //       
+                vector<Secret> valid;
+                vector<size_t> positions;
+                vector<int64_t> deadlines;
+                json results = json::array();
+                for (size_t i = 0; i < items.size(); i++) {
+                    results.push_back({ {"index", i} });
+                    if (!items[i].error.empty()) {
+                        results[i]["error"] = items[i].error;
+                        continue;
+                    }
+                    int64_t deadline = expiryDeadline(items[i].value.expiresInDays);
+                    items[i].value.secret.expires_at = deadline;
+                    valid.push_back(move(items[i].value.secret));
+                    positions.push_back(i);
+                    deadlines.push_back(deadline);
+                }
+
+                size_t created = 0;
+                auto imported = db.addSecretsBatch(valid, " ");
+                for (size_t k = 0; k < imported.size(); k++) {
+                    json& item = results[positions[k]];
+                    if (imported[k].error.empty()) {
+                        item["secret_id"] = imported[k].id_secrets;
+                        if (deadlines[k]) expiry.track(imported[k].id_secrets, deadlines[k]);
+                        created++;
+                    }
+                    else {
+                        item["error"] = imported[k].error;
+                    }
+                }
+                sendSuccess(res, {
+                    {"created", created},
+                    {"failed", items.size() - created},
+                    {"results", results}
+                    });
+            }
+            catch (const PayloadTooLargeException& e) {
+                sendError(res, 413, e.what());
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
+            }
             catch (const exception& e) {
                 sendError(res, 500, e.what());
             }
             });
         server.Get("/api/secrets", [this](const httplib::Request& req, httplib::Response& res) {
             try {
-                auto j = json::parse(req.body);
-                string username = j.value("username", "");
-                string password = j.value("password", "");
-                auto secrets = getSecretsByRole(username, password);
-                json arr = json::array();
-                for (auto& s : secrets) {
-                    arr.push_back({
-                        {"id_secrets", s.id_secrets},
-                        {"owner_id", s.owner_id},
-                        {"secret_value", s.secret_value},
-                        {"secret_type", s.secret_type},
-                        {"created_at", s.created_at},
-                        {"expires_at", s.expires_at}
-                        });
+                Identity identity = identify(req);
+                PageRequest page;
+                bool paged = parsePageRequest(req, page);
+                string tag = secretsTag(req, identity);
+                if (notModified(req, res, tag)) return;
+                res.set_header("ETag", tag);
+                if (paged) {
+                    auto result = getSecretsPageByRole(identity, page);
+                    sendPage(res, "secrets", result, writeSecret);
+                    return;
+                }
+                sendJsonStream(res, "secrets", getSecretsByRole(identity), writeSecret);
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const HasherBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const exception& e) {
+                sendError(res, 401, e.what());
+            }
+            });
+        server.Get("/api/secrets/search", [this](const httplib::Request& req, httplib::Response& res) {
+            try {
+                string query = req.get_param_value("q");
+                if (DataBase::utf8Length(query) < DataBase::FTS_MIN_PATTERN) {
+                    sendError(res, 400, " q     " +
+                        to_string(DataBase::FTS_MIN_PATTERN) + " ");
+                    return;
+                }
+                size_t limit = DEFAULT_SEARCH_LIMIT;
+                if (req.has_param("limit")) {
+                    PageRequest page;
+                    parsePageRequest(req, page);
+                    limit = page.limit;
                 }
-                sendSuccess(res, { {"secrets", arr} });
+
+                auto secrets = searchSecretsByRole(identify(req), query, limit);
+                sendItems(res, "secrets", secrets, writeSecret);
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const HasherBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
             }
             catch (const exception& e) {
                 sendError(res, 401, e.what());
             }
             });
         server.Get(R"(/api/secrets/(\d+))", [this](const httplib::Request& req, httplib::Response& res) {
-            int id = stoi(req.matches[1]);
-            Secret s = db.getSecretById(id);
-            sendSuccess(res, {
-                {"id_secrets", s.id_secrets},
-                {"owner_id", s.owner_id},
-                {"secret_value", s.secret_value},
-                {"secret_type", s.secret_type},
-                {"created_at", s.created_at},
-                {"expires_at", s.expires_at}
-                });
+            try {
+                int id = stoi(req.matches[1]);
+                uint64_t changeVersion = db.getChangeVersions().secretVersion(id);
+                string tag = entityTag(req, "secret", changeVersion);
+                if (notModified(req, res, tag)) return;
+                //     ( ,    ) - 
+                auto cached = cache.get(id, changeVersion);
+                if (!cached) {
+                    uint64_t version = cache.version(id);
+                    cached = db.getSecretById(id);
+                    cache.put(*cached, version, changeVersion);
+                }
+                res.set_header("ETag", tag);
+                sendSuccessWith(res, [&](JsonWriter& w) { writeSecret(w, *cached); });
+            }
+            catch (const NotFoundException& e) {
+                sendError(res, 404, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const exception& e) {
+                sendError(res, 500, e.what());
+            }
             });
         server.Delete(R"(/api/secrets/(\d+))", [this](const httplib::Request& req, httplib::Response& res) {
-            int id = stoi(req.matches[1]);
-            db.deleteSecret(id);
-            db.addAuditLog(0, " ", "secret", id);
-            sendSuccess(res, { {"deleted", id} });
+            try {
+                int id = stoi(req.matches[1]);
+                Credentials credentials;
+                if (!req.body.empty()) {
+                    credentials = request::parseRecord(req.body, credentialFields(), MAX_BODY_BYTES);
+                }
+                int actor = auditActor(req, credentials.username, credentials.password);
+                long long deleted = db.deleteSecretAsync(id).get();
+                cache.invalidate(id);
+                if (deleted == 0) {
+                    sendError(res, 404, "  ");
+                    return;
+                }
+                audit.log(actor, " ", "secret", id);
+                sendSuccess(res, { {"deleted", id} });
+            }
+            catch (const PayloadTooLargeException& e) {
+                sendError(res, 413, e.what());
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const HasherBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const exception& e) {
+                sendError(res, 500, e.what());
+            }
             });
         server.Put(R"(/api/secrets/(\d+))", [this](const httplib::Request& req, httplib::Response& res) {
-            int secretId = stoi(req.matches[1]);
-            auto j = json::parse(req.body);
-            Secret s;
-            s.secret_value = j["secret_value"];
-            s.secret_type = j["secret_type"];
-            int expires_in_days = j.value("expires_in_days", 0);
-            if (expires_in_days > 0) {
-                time_t now = time(nullptr);
-                now += expires_in_days * 24 * 3600;
-                char buffer[20];
-                strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&now));
-                s.expires_at = buffer;
-            }
-            bool success = db.updateSecret(secretId, s);
-            db.addAuditLog(0, " ", "secret", secretId);
-            sendSuccess(res, { {"success", success} });
+            try {
+                int secretId = stoi(req.matches[1]);
+                SecretInput input = request::parseRecord(req.body, secretFields(false), MAX_BODY_BYTES);
+                int actor = auditActor(req, input.username, input.password);
+                Secret& s = input.secret;
+                int64_t deadline = expiryDeadline(input.expiresInDays);
+                s.expires_at = deadline;
+                bool success = db.updateSecret(secretId, s);
+                cache.invalidate(secretId);
+                if (success && deadline) expiry.track(secretId, deadline);
+                audit.log(actor, " ", "secret", secretId);
+                sendSuccess(res, { {"success", success} });
+            }
+            catch (const PayloadTooLargeException& e) {
+                sendError(res, 413, e.what());
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const HasherBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const NotFoundException& e) {
+                sendError(res, 404, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const exception& e) {
+                sendError(res, 500, e.what());
+            }
             });
         server.Get("/api/audit_logs", [this](const httplib::Request& req, httplib::Response& res) {
             try {
-                auto j = json::parse(req.body);
-                string username = j.value("username", "");
-                string password = j.value("password", "");
-
-                auto logs = getAuditLogsByRole(username, password);
-                json arr = json::array();
-                for (auto& log : logs) {
-                    arr.push_back({
-                        {"id_audit_logs", log.id_audit_logs},
-                        {"user_id", log.user_id},
-                        {"action", log.action},
-                        {"object_type", log.object_type},
-                        {"object_id", log.object_id},
-                        {"created_at", log.created_at}
-                        });
+                Identity identity = identify(req);
+                AuditFilter filter = parseAuditFilter(req);
+                PageRequest page;
+                if (parsePageRequest(req, page)) {
+                    auto result = getAuditLogsPageByRole(identity, filter, page);
+                    sendPage(res, "audit_logs", result, writeAuditLog);
+                    return;
                 }
-                sendSuccess(res, { {"audit_logs", arr} });
+                sendJsonStream(res, "audit_logs", getAuditLogsByRole(identity, filter), writeAuditLog);
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const HasherBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const exception& e) {
+                sendError(res, 401, e.what());
+            }
+            });
+
+        //        SIEM;  
+        server.Get(R"(/api/export/(secrets|audit_logs))", [this](const httplib::Request& req, httplib::Response& res) {
+            try {
+                Identity identity = identify(req);
+                if (!identity.isAdmin()) {
+                    sendError(res, 403, "   ");
+                    return;
+                }
+                long long afterId = parseAfterId(req);
+                if (req.matches[1] == "secrets") {
+                    sendNdjsonStream(res, db.streamSecretsForExport(afterId), writeSecret);
+                }
+                else {
+                    sendNdjsonStream(res, db.streamAuditLogsForExport(afterId), writeAuditLog);
+                }
+            }
+            catch (const invalid_argument& e) {
+                sendError(res, 400, e.what());
+            }
+            catch (const HasherBusyException& e) {
+                sendBusy(res, e.what());
+            }
+            catch (const DatabaseBusyException& e) {
+                sendBusy(res, e.what());
             }
             catch (const exception& e) {
                 sendError(res, 401, e.what());
@@ -294,13 +1085,108 @@ public:
                 {"last_active_user", stats.lastActiveUser}
                 });
             });
+
+        server.Get("/api/metrics", [this](const httplib::Request&, httplib::Response& res) {
+            auto stmtStats = db.getStatementCacheStats();
+            auto writeStats = db.getWriteQueueStats();
+            auto auditStats = audit.stats();
+            auto sessionStats = sessions.stats();
+            auto hasherStats = hasher.stats();
+            auto expiryStats = expiry.stats();
+            auto cacheStats = cache.stats();
+            auto serverStats = connections->stats();
+            sendSuccess(res, {
+                {"server", {
+                    {"workers", serverStats.workers},
+                    {"busy", serverStats.busy},
+                    {"queue_depth", serverStats.queueDepth},
+                    {"max_queued", serverConfig.maxQueued},
+                    {"accepted", serverStats.accepted},
+                    {"shed", serverStats.shed},
+                    {"dropped", serverStats.dropped}
+                    }},
+                {"statement_cache", {
+                    {"hits", stmtStats.hits},
+                    {"misses", stmtStats.misses}
+                    }},
+                {"connection_pool", {
+                    {"readers", db.getReaderCount()}
+                    }},
+                {"writer", {
+                    {"batches", writeStats.batches},
+                    {"operations", writeStats.operations},
+                    {"queue_depth", writeStats.queueDepth}
+                    }},
+                {"audit", {
+                    {"mode", audit.durability() == AuditDurability::Async ? "async" : "wait_for_flush"},
+                    {"queue_depth", auditStats.queueDepth},
+                    {"enqueued", auditStats.enqueued},
+                    {"flushed", auditStats.flushed},
+                    {"dropped", auditStats.dropped},
+                    {"failed", auditStats.failed},
+                    {"batches", auditStats.batches},
+                    {"last_flush_us", auditStats.lastFlushMicros},
+                    {"avg_flush_us", auditStats.avgFlushMicros},
+                    {"max_flush_us", auditStats.maxFlushMicros}
+                    }},
+                {"sessions", {
+                    {"active", sessionStats.active},
+                    {"issued", sessionStats.issued},
+                    {"revoked", sessionStats.revoked},
+                    {"expired", sessionStats.expired}
+                    }},
+                {"password_hasher", {
+                    {"threads", hasherStats.threads},
+                    {"queue_depth", hasherStats.queueDepth},
+                    {"completed", hasherStats.completed},
+                    {"rejected", hasherStats.rejected},
+                    {"iterations", hasherStats.iterations}
+                    }},
+                {"expiry", {
+                    {"tracked", expiryStats.tracked},
+                    {"deleted", expiryStats.deleted},
+                    {"batches", expiryStats.batches},
+                    {"refills", expiryStats.refills}
+                    }},
+                {"secret_cache", {
+                    {"size", cacheStats.size},
+                    {"capacity", cacheStats.capacity},
+                    {"hits", cacheStats.hits},
+                    {"misses", cacheStats.misses},
+                    {"hit_ratio", cacheStats.hits + cacheStats.misses
+                        ? (double)cacheStats.hits / (cacheStats.hits + cacheStats.misses) : 0.0},
+                    {"evictions", cacheStats.evictions},
+                    {"invalidations", cacheStats.invalidations}
+                    }}
+                });
+            });
+    }
+
+    // ,  , keep-alive  -  ServerConfig
+    void configureServer() {
+        server.new_task_queue = [this] {
+            size_t workers = serverConfig.workers ? serverConfig.workers : CPPHTTPLIB_THREAD_POOL_COUNT;
+            connections = new LoadSheddingQueue(workers, serverConfig.maxQueued, serverConfig.shedQueue);
+            return connections;
+            };
+        //    SheddingServer  503 ,  
+        server.setRetryAfter(serverConfig.retryAfter);
+        server.set_keep_alive_max_count(serverConfig.keepAliveMaxCount);
+        server.set_keep_alive_timeout(serverConfig.keepAliveTimeout.count());
+        server.set_read_timeout(serverConfig.readTimeout);
+        server.set_write_timeout(serverConfig.writeTimeout);
     }
 
     void run(const string& dbPath, int port = 8080) {
         db.open(dbPath);
+        audit.start();
+        expiry.start();
+        configureServer();
         initRoutes();
         cout << "    " << port << endl;
         server.listen("0.0.0.0", port);
+        expiry.stop();
+        audit.stop();
         db.close();
     }
 };
@@ -0,0 +1,180 @@
+﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Пользователь, от имени которого выполняется запрос
+struct Identity {
+    int userId;
+    string username;
+    string role;
+
+    Identity() : userId(0) {}
+    Identity(int userId, const string& username, const string& role)
+        : userId(userId), username(username), role(role) {}
+
+    bool isAdmin() const { return role == "admin"; }
+};
+
+struct SessionConfig {
+    chrono::seconds ttl = chrono::minutes(30);     // срок жизни без обращений
+    size_t shards = 16;
+};
+
+// Таблица сессий в памяти: токен -> пользователь. Разбита на сегменты
+// со своими мьютексами, чтобы параллельные запросы не ждали друг друга.
+// Срок жизни продлевается при каждом обращении; истекшие сессии удаляются
+// при обращении к ним и при периодической чистке сегмента
+class SessionStore {
+public:
+    struct Stats {
+        size_t active;
+        uint64_t issued;
+        uint64_t revoked;
+        uint64_t expired;
+    };
+
+    explicit SessionStore(const SessionConfig& config = SessionConfig())
+        : config(config), shards(config.shards ? config.shards : 1), issued(0), revoked(0), expired(0) {}
+
+    // Новая сессия; возвращает токен
+    string issue(const Identity& identity) {
+        string token = generateToken();
+        auto now = Clock::now();
+        Shard& shard = shardOf(token);
+        lock_guard<mutex> lock(shard.lock);
+        if (++shard.issuesSinceSweep >= SWEEP_EVERY) {
+            shard.issuesSinceSweep = 0;
+            sweep(shard, now);
+        }
+        shard.sessions[token] = Session{ identity, now + config.ttl };
+        issued++;
+        return token;
+    }
+
+    optional<Identity> resolve(const string& token) {
+        if (token.empty()) return nullopt;
+        auto now = Clock::now();
+        Shard& shard = shardOf(token);
+        lock_guard<mutex> lock(shard.lock);
+        auto it = shard.sessions.find(token);
+        if (it == shard.sessions.end()) return nullopt;
+        if (it->second.expiresAt <= now) {
+            shard.sessions.erase(it);
+            expired++;
+            return nullopt;
+        }
+        it->second.expiresAt = now + config.ttl;
+        return it->second.identity;
+    }
+
+    bool revoke(const string& token) {
+        Shard& shard = shardOf(token);
+        lock_guard<mutex> lock(shard.lock);
+        if (shard.sessions.erase(token) == 0) return false;
+        revoked++;
+        return true;
+    }
+
+    // Завершение всех сессий пользователя (например, после его удаления)
+    size_t revokeUser(int userId) {
+        size_t count = 0;
+        for (auto& shard : shards) {
+            lock_guard<mutex> lock(shard.lock);
+            for (auto it = shard.sessions.begin(); it != shard.sessions.end();) {
+                if (it->second.identity.userId == userId) {
+                    it = shard.sessions.erase(it);
+                    count++;
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+        revoked += count;
+        return count;
+    }
+
+    void clear() {
+        for (auto& shard : shards) {
+            lock_guard<mutex> lock(shard.lock);
+            shard.sessions.clear();
+        }
+    }
+
+    chrono::seconds ttl() const { return config.ttl; }
+
+    Stats stats() {
+        size_t active = 0;
+        for (auto& shard : shards) {
+            lock_guard<mutex> lock(shard.lock);
+            active += shard.sessions.size();
+        }
+        return { active, issued.load(), revoked.load(), expired.load() };
+    }
+
+private:
+    using Clock = chrono::steady_clock;
+    static constexpr size_t TOKEN_BYTES = 32;
+    static constexpr uint32_t SWEEP_EVERY = 256;
+
+    struct Session {
+        Identity identity;
+        Clock::time_point expiresAt;
+    };
+
+    struct Shard {
+        mutex lock;
+        unordered_map<string, Session> sessions;
+        uint32_t issuesSinceSweep = 0;
+    };
+
+    SessionConfig config;
+    vector<Shard> shards;
+    mutex randomMutex;
+    random_device random;
+    atomic<uint64_t> issued;
+    atomic<uint64_t> revoked;
+    atomic<uint64_t> expired;
+
+    Shard& shardOf(const string& token) {
+        return shards[hash<string>()(token) % shards.size()];
+    }
+
+    void sweep(Shard& shard, Clock::time_point now) {
+        for (auto it = shard.sessions.begin(); it != shard.sessions.end();) {
+            if (it->second.expiresAt <= now) {
+                it = shard.sessions.erase(it);
+                expired++;
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    // Токен - 256 бит из системного криптографического генератора в hex
+    string generateToken() {
+        static const char digits[] = "0123456789abcdef";
+        string token;
+        token.reserve(TOKEN_BYTES * 2);
+        lock_guard<mutex> lock(randomMutex);
+        for (size_t i = 0; i < TOKEN_BYTES; i += 4) {
+            uint32_t value = random();
+            for (int b = 0; b < 4; b++, value >>= 8) {
+                token += digits[(value >> 4) & 0x0F];
+                token += digits[value & 0x0F];
+            }
+        }
+        return token;
+    }
+};
@@ -0,0 +1,100 @@
+﻿#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+using namespace std;
+
+// Время хранится в базе как int64 - микросекунды Unix (UTC).
+// В строку "YYYY-MM-DD HH:MM:SS" оно превращается только на выходе в JSON
+namespace timestamp {
+
+    constexpr int64_t MICROS_PER_SECOND = 1000000;
+
+    inline int64_t nowMicros() {
+        return chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Число дней от 1970-01-01 до даты григорианского календаря
+    inline int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+        y -= m <= 2;
+        int64_t era = (y >= 0 ? y : y - 399) / 400;
+        unsigned yoe = (unsigned)(y - era * 400);
+        unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + (int64_t)doe - 719468;
+    }
+
+    // "YYYY-MM-DD" или "YYYY-MM-DD HH:MM:SS" (UTC) в микросекунды.
+    // false - строка не в этом формате
+    inline bool parse(const string& text, int64_t& micros) {
+        static const string pattern = "0000-00-00 00:00:00";
+        if (text.size() != 10 && text.size() != pattern.size()) return false;
+        for (size_t i = 0; i < text.size(); i++) {
+            bool digit = text[i] >= '0' && text[i] <= '9';
+            if (pattern[i] == '0' ? !digit : text[i] != pattern[i]) return false;
+        }
+
+        auto number = [&](size_t pos, size_t len) {
+            int value = 0;
+            for (size_t i = pos; i < pos + len; i++) value = value * 10 + (text[i] - '0');
+            return value;
+        };
+        int month = number(5, 2), day = number(8, 2);
+        int hour = 0, minute = 0, second = 0;
+        if (text.size() > 10) {
+            hour = number(11, 2);
+            minute = number(14, 2);
+            second = number(17, 2);
+        }
+        if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 59) {
+            return false;
+        }
+
+        int64_t days = daysFromCivil(number(0, 4), (unsigned)month, (unsigned)day);
+        micros = ((days * 24 + hour) * 60 + minute) * 60 * MICROS_PER_SECOND + (int64_t)second * MICROS_PER_SECOND;
+        return true;
+    }
+
+    // Микросекунды в "YYYY-MM-DD HH:MM:SS" (UTC); 0 - пустая строка.
+    // Подряд идущие значения обычно попадают в одну секунду, поэтому
+    // последняя отформатированная секунда кэшируется в каждом потоке
+    inline string format(int64_t micros) {
+        if (micros == 0) return string();
+
+        int64_t seconds = micros / MICROS_PER_SECOND;
+        if (micros < 0 && micros % MICROS_PER_SECOND != 0) seconds--;
+
+        thread_local int64_t cachedSecond = 0;
+        thread_local string cachedText;
+        if (seconds == cachedSecond && !cachedText.empty()) return cachedText;
+
+        int64_t days = seconds / 86400;
+        int64_t rest = seconds % 86400;
+        if (rest < 0) {
+            rest += 86400;
+            days--;
+        }
+
+        // Обратное к daysFromCivil преобразование
+        int64_t z = days + 719468;
+        int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+        unsigned doe = (unsigned)(z - era * 146097);
+        unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        int64_t year = (int64_t)yoe + era * 400;
+        unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        unsigned mp = (5 * doy + 2) / 153;
+        unsigned day = doy - (153 * mp + 2) / 5 + 1;
+        unsigned month = mp < 10 ? mp + 3 : mp - 9;
+        if (month <= 2) year++;
+
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%04lld-%02u-%02u %02d:%02d:%02d",
+            (long long)year, month, day, (int)(rest / 3600), (int)(rest / 60 % 60), (int)(rest % 60));
+
+        cachedSecond = seconds;
+        cachedText = buffer;
+        return cachedText;
+    }
+}